@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "chanlog.h"
+#include "checkpoint.h"
+
+/* ******************************************************************
+   Channel decision log file format: the 8 byte magic CHANLOG_MAGIC
+   followed by one 3 byte record per packet handed to tolayer3, in the
+   order they were sent:
+
+     byte 0    bit 0 sending entity, bit 1 lost, bits 2-3 corruption kind
+     byte 1-2  propagation delay, little endian, 1 + 9*q/65535 time units
+
+   Delays are quantized when recorded and the recording run itself uses
+   the quantized value, so a replay of the same protocol is identical.
+   Replay reads the file through two independent streams, one per
+   direction, each skipping the other direction's records.
+**********************************************************************/
+
+#define CHANLOG_MAGIC  "CHANLOG1"
+#define CHANLOG_RECLEN 3
+#define CHANLOG_SEED   0x9e3779b97f4a7c15ULL
+#define CHANLOG_BUF    (1 << 16)
+#define FNV_OFFSET     0xcbf29ce484222325ULL
+#define FNV_PRIME      0x100000001b3ULL
+
+int chanlog_mode = CHANLOG_OFF;
+
+static const char *logname;
+static FILE *logfp;                   /* file being recorded */
+static FILE *replayfp[2];             /* replay stream of each direction */
+static unsigned long long rngstate = CHANLOG_SEED;
+static long long ndecisions[2];       /* decisions made in each direction */
+static int exhausted[2];
+
+static void chanlog_fail(const char *what)
+{
+  printf("channel log %s: %s\n", logname, what);
+  exit(EXIT_FAILURE);
+}
+
+void chanlog_open(int mode, const char *name)
+{
+  char magic[8];
+  int i;
+
+  chanlog_mode = mode;
+  logname = name;
+  if (mode == CHANLOG_RECORD) {
+    logfp = fopen(name, "wb");
+    if (logfp == NULL)
+      chanlog_fail("cannot create file");
+    setvbuf(logfp, NULL, _IOFBF, CHANLOG_BUF);
+    if (fwrite(CHANLOG_MAGIC, 1, 8, logfp) != 8)
+      chanlog_fail("write failed");
+  }
+  else if (mode == CHANLOG_REPLAY) {
+    for (i = 0; i < 2; i++) {
+      replayfp[i] = fopen(name, "rb");
+      if (replayfp[i] == NULL)
+        chanlog_fail("cannot open file");
+      setvbuf(replayfp[i], NULL, _IOFBF, CHANLOG_BUF);
+      if (fread(magic, 1, 8, replayfp[i]) != 8 || memcmp(magic, CHANLOG_MAGIC, 8) != 0)
+        chanlog_fail("not a channel decision log");
+    }
+  }
+}
+
+void chanlog_close(void)
+{
+  int i;
+
+  if (logfp != NULL && fclose(logfp) != 0)
+    chanlog_fail("write failed");
+  logfp = NULL;
+  for (i = 0; i < 2; i++) {
+    if (replayfp[i] != NULL)
+      fclose(replayfp[i]);
+    replayfp[i] = NULL;
+  }
+}
+
+/* start a new run from the beginning of the channel stream and the log */
+void chanlog_reset(void)
+{
+  int i;
+
+  rngstate = CHANLOG_SEED;
+  for (i = 0; i < 2; i++) {
+    ndecisions[i] = 0;
+    exhausted[i] = 0;
+    if (replayfp[i] != NULL && fseek(replayfp[i], 8, SEEK_SET) != 0)
+      chanlog_fail("cannot rewind");
+  }
+}
+
+/* uniform on [0,1), from a splitmix64 generator private to the channel */
+double chanlog_rand(void)
+{
+  unsigned long long z;
+
+  z = (rngstate += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned int quantize(double delay)
+{
+  double q = (delay - 1) / 9 * 65535 + 0.5;
+
+  if (q < 0)
+    return 0;
+  if (q > 65535)
+    return 65535;
+  return (unsigned int)q;
+}
+
+/* the delay that will actually be recorded for a drawn delay */
+double chanlog_quantize(double delay)
+{
+  return 1 + 9 * quantize(delay) / 65535.0;
+}
+
+void chanlog_put(int AorB, const struct chandecision *d)
+{
+  unsigned char rec[CHANLOG_RECLEN];
+  unsigned int q = d->lost ? 0 : quantize(d->delay);
+
+  rec[0] = (AorB & 1) | (d->lost ? 2 : 0) | (d->corrupt << 2);
+  rec[1] = q & 0xff;
+  rec[2] = q >> 8;
+  if (logfp != NULL && fwrite(rec, 1, CHANLOG_RECLEN, logfp) != CHANLOG_RECLEN)
+    chanlog_fail("write failed");
+  ndecisions[AorB]++;
+}
+
+/* next recorded decision for a packet sent by AorB; 0 when the log has
+   no more decisions for that direction */
+int chanlog_get(int AorB, struct chandecision *d)
+{
+  unsigned char rec[CHANLOG_RECLEN];
+
+  while (fread(rec, 1, CHANLOG_RECLEN, replayfp[AorB]) == CHANLOG_RECLEN) {
+    if ((rec[0] & 1) != AorB)
+      continue;
+    d->lost = (rec[0] & 2) != 0;
+    d->corrupt = (rec[0] >> 2) & 3;
+    d->delay = 1 + 9 * (rec[1] | (rec[2] << 8)) / 65535.0;
+    ndecisions[AorB]++;
+    return 1;
+  }
+  if (!exhausted[AorB]) {
+    printf("Warning: channel log %s has no more decisions for %s, drawing new ones\n",
+           logname, AorB == A ? "A->B" : "B->A");
+    exhausted[AorB] = 1;
+  }
+  return 0;
+}
+
+/* FNV-1a hash of the whole log being replayed */
+static unsigned long long loghash(void)
+{
+  unsigned long long h = FNV_OFFSET;
+  FILE *fp;
+  int ch;
+
+  fp = fopen(logname, "rb");
+  if (fp == NULL)
+    chanlog_fail("cannot open file");
+  while ((ch = getc(fp)) != EOF)
+    h = (h ^ (unsigned char)ch) * FNV_PRIME;
+  fclose(fp);
+  return h;
+}
+
+/* save or restore the mode, the channel random stream and the replay
+   positions.  A resumed run must get its decisions the way the original
+   did, so a snapshot of a replay needs the same log and one taken
+   without a log cannot replay one.  A recording run resumes drawing
+   from the channel stream, but the rest of it is not recorded */
+void chanlog_checkpoint(struct ckpt *c)
+{
+  struct chandecision d;
+  unsigned long long hash = 0;
+  long long n[2];
+  int mode = chanlog_mode, i;
+
+  if (CKPT_SAVING(c) && chanlog_mode == CHANLOG_REPLAY)
+    hash = loghash();
+  CKPT_IO(c, mode);
+  CKPT_IO(c, hash);
+  CKPT_IO(c, rngstate);
+  n[A] = ndecisions[A];
+  n[B] = ndecisions[B];
+  CKPT_IO(c, n);
+  if (CKPT_SAVING(c))
+    return;
+  if (chanlog_mode == CHANLOG_RECORD) {
+    printf("channel log %s: cannot record when resuming from a snapshot\n", logname);
+    exit(EXIT_FAILURE);
+  }
+  if (mode == CHANLOG_REPLAY && chanlog_mode != CHANLOG_REPLAY) {
+    printf("checkpoint %s: the run replays a channel log, give it with -U\n", c->name);
+    exit(EXIT_FAILURE);
+  }
+  if (mode != CHANLOG_REPLAY && chanlog_mode == CHANLOG_REPLAY) {
+    printf("checkpoint %s: the run does not replay a channel log, -U cannot be given\n",
+           c->name);
+    exit(EXIT_FAILURE);
+  }
+  if (mode == CHANLOG_REPLAY && hash != loghash()) {
+    printf("checkpoint %s: channel log %s is not the one the run replays\n", c->name, logname);
+    exit(EXIT_FAILURE);
+  }
+  if (mode == CHANLOG_RECORD) {
+    printf("Warning: checkpoint %s was recording a channel log, "
+           "the rest of the run is not recorded\n", c->name);
+    chanlog_mode = CHANLOG_RECORD;
+  }
+  if (chanlog_mode == CHANLOG_REPLAY)
+    for (i = 0; i < 2; i++)
+      while (ndecisions[i] < n[i] && chanlog_get(i, &d))
+        ;
+  ndecisions[A] = n[A];
+  ndecisions[B] = n[B];
+}
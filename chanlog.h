@@ -0,0 +1,42 @@
+/* ******************************************************************
+   Channel decision log.  In record mode every loss, corruption and
+   delay decision tolayer3 makes is written to a binary file, indexed by
+   transmission order in each direction.  In replay mode the decisions
+   are read back from such a file instead of being drawn, so different
+   protocols (or versions of one) can be run over exactly the same
+   sequence of impairments.
+
+   While recording or replaying, channel decisions come from a random
+   number stream of their own, so the message arrival process does not
+   depend on how many packets the protocol sends.
+**********************************************************************/
+
+#define CHANLOG_OFF    0
+#define CHANLOG_RECORD 1
+#define CHANLOG_REPLAY 2
+
+/* kinds of corruption */
+#define CORRUPT_NONE    0
+#define CORRUPT_PAYLOAD 1
+#define CORRUPT_SEQNUM  2
+#define CORRUPT_ACKNUM  3
+
+/* the fate of one packet handed to tolayer3 */
+struct chandecision {
+  int lost;
+  int corrupt;        /* one of the CORRUPT_ kinds */
+  double delay;       /* propagation delay in time units, 1..10 */
+};
+
+extern int chanlog_mode;
+
+extern void chanlog_open(int mode, const char *name);
+extern void chanlog_close(void);
+extern void chanlog_reset(void);
+extern double chanlog_rand(void);
+extern double chanlog_quantize(double delay);
+extern void chanlog_put(int AorB, const struct chandecision *d);
+extern int chanlog_get(int AorB, struct chandecision *d);
+
+struct ckpt;
+extern void chanlog_checkpoint(struct ckpt *c);
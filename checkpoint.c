@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "checkpoint.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_MMAP 1
+#endif
+
+/* ******************************************************************
+   Reading and writing of checkpoint files.  A snapshot is written
+   sequentially through stdio and restored from a read-only memory
+   mapping of the file (or a heap copy where mmap is not available).
+   Any I/O problem or a malformed file ends the run.
+**********************************************************************/
+
+static void ckpt_fail(struct ckpt *c, const char *what)
+{
+  printf("checkpoint %s: %s\n", c->name, what);
+  exit(EXIT_FAILURE);
+}
+
+void ckpt_create(struct ckpt *c, const char *name)
+{
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->fp = fopen(name, "wb");
+  if (c->fp == NULL)
+    ckpt_fail(c, "cannot create file");
+}
+
+void ckpt_open(struct ckpt *c, const char *name)
+{
+#ifdef HAVE_MMAP
+  struct stat st;
+  int fd;
+#else
+  FILE *fp;
+  long len;
+#endif
+
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+#ifdef HAVE_MMAP
+  fd = open(name, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0)
+    ckpt_fail(c, "cannot open file");
+  c->size = st.st_size;
+  c->base = mmap(NULL, c->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (c->base == MAP_FAILED)
+    ckpt_fail(c, "cannot map file");
+#else
+  fp = fopen(name, "rb");
+  if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0)
+    ckpt_fail(c, "cannot open file");
+  rewind(fp);
+  c->size = len;
+  c->base = malloc(c->size);
+  if (c->base == NULL || fread(c->base, 1, c->size, fp) != c->size)
+    ckpt_fail(c, "cannot read file");
+  fclose(fp);
+#endif
+}
+
+void ckpt_close(struct ckpt *c)
+{
+  if (CKPT_SAVING(c)) {
+    if (fclose(c->fp) != 0)
+      ckpt_fail(c, "write failed");
+  }
+  else if (c->base != NULL) {
+    if (c->pos != c->size)
+      ckpt_fail(c, "trailing data in file");
+#ifdef HAVE_MMAP
+    munmap(c->base, c->size);
+#else
+    free(c->base);
+#endif
+  }
+  c->fp = NULL;
+  c->base = NULL;
+}
+
+void ckpt_put(struct ckpt *c, const void *data, size_t len)
+{
+  if (fwrite(data, 1, len, c->fp) != len)
+    ckpt_fail(c, "write failed");
+}
+
+void ckpt_get(struct ckpt *c, void *data, size_t len)
+{
+  if (len > c->size - c->pos)
+    ckpt_fail(c, "file is truncated");
+  memcpy(data, c->base + c->pos, len);
+  c->pos += len;
+}
+
+void ckpt_io(struct ckpt *c, void *data, size_t len)
+{
+  if (CKPT_SAVING(c))
+    ckpt_put(c, data, len);
+  else
+    ckpt_get(c, data, len);
+}
+
+/* write a marker, or check that the same marker is next in the file */
+void ckpt_tag(struct ckpt *c, const char *tag)
+{
+  size_t len = strlen(tag);
+
+  if (CKPT_SAVING(c))
+    ckpt_put(c, tag, len);
+  else {
+    if (len > c->size - c->pos || memcmp(c->base + c->pos, tag, len) != 0)
+      ckpt_fail(c, "not a snapshot of this emulator and protocol");
+    c->pos += len;
+  }
+}
@@ -0,0 +1,36 @@
+/* ******************************************************************
+   Checkpoint files: a compact binary snapshot of the whole simulation
+   (scenario, clock, counters, random number state, event list, link
+   queues and the protocol entities) taken at a chosen simulated time.
+
+   The emulator, the link model and the protocols each have one routine
+   that passes their state through CKPT_IO(), which writes it when a
+   snapshot is being taken and reads it back, in the same order, when
+   one is being restored.  Restoring maps the file into memory.
+**********************************************************************/
+
+#define CKPT_MAGIC   "EMUCKPT"
+#define CKPT_VERSION 11
+
+struct ckpt {
+  FILE *fp;          /* file being written, NULL when restoring */
+  char *base;        /* mapped file being restored */
+  size_t size;
+  size_t pos;        /* read position within base */
+  const char *name;  /* file name, for error messages */
+};
+
+extern void ckpt_create(struct ckpt *c, const char *name);
+extern void ckpt_open(struct ckpt *c, const char *name);
+extern void ckpt_close(struct ckpt *c);
+extern void ckpt_put(struct ckpt *c, const void *data, size_t len);
+extern void ckpt_get(struct ckpt *c, void *data, size_t len);
+extern void ckpt_io(struct ckpt *c, void *data, size_t len);
+extern void ckpt_tag(struct ckpt *c, const char *tag);
+
+/* true while writing a snapshot, false while restoring one */
+#define CKPT_SAVING(c) ((c)->fp != NULL)
+
+/* save or restore one variable, depending on the direction of c.
+   Works for scalars, structs and arrays. */
+#define CKPT_IO(c, v) ckpt_io((c), &(v), sizeof(v))
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "compress.h"
+#include "checkpoint.h"
+
+#define MSGSIZE      20
+#define LZ_MATCH     0x80   /* token bit: a copy rather than literals */
+#define LZ_MINMATCH  3      /* shorter copies cost more than the literals */
+
+int compress_kind = COMPRESS_NONE;
+
+static const char *names[] = { "none", "rle", "lz", NULL };
+
+struct compstats {
+  long long messages;        /* messages compressed at A */
+  long long bytes;           /* payload bytes they were sent as */
+  long long raw;             /* ... of them sent raw, the codec could not shrink them */
+  long long failed;          /* payloads B could not decompress */
+};
+
+static struct compstats st;
+
+/* COMPRESS_ constant for a codec name, -1 if there is none */
+int compress_byname(const char *name)
+{
+  int i;
+
+  for (i = 0; names[i] != NULL; i++)
+    if (strcmp(names[i], name) == 0)
+      return i;
+  return -1;
+}
+
+void compress_reset(void)
+{
+  memset(&st, 0, sizeof(st));
+}
+
+/* (count, byte) pairs; returns the length, MSGSIZE if that is no shorter */
+static int rle_encode(const char *in, char *out)
+{
+  int i, run, n = 1;
+
+  out[0] = COMPRESS_RLE;
+  for (i = 0; i < MSGSIZE; i += run) {
+    for (run = 1; i + run < MSGSIZE && in[i + run] == in[i]; run++)
+      ;
+    if (n + 2 >= MSGSIZE)
+      return MSGSIZE;
+    out[n++] = (char)run;
+    out[n++] = in[i];
+  }
+  return n;
+}
+
+static int rle_decode(const char *in, int length, char *out)
+{
+  int i, j, run, n = 0;
+
+  for (i = 1; i + 1 < length; i += 2) {
+    run = (unsigned char)in[i];
+    if (run == 0 || n + run > MSGSIZE)
+      return -1;
+    for (j = 0; j < run; j++)
+      out[n++] = in[i + 1];
+  }
+  return i == length && n == MSGSIZE ? 0 : -1;
+}
+
+/* literals in[from..to) as one token at out[*n]; 0 if they do not fit */
+static int lz_literals(const char *in, int from, int to, char *out, int *n)
+{
+  if (from == to)
+    return 1;
+  if (*n + 1 + to - from >= MSGSIZE)
+    return 0;
+  out[(*n)++] = (char)(to - from - 1);
+  memcpy(out + *n, in + from, to - from);
+  *n += to - from;
+  return 1;
+}
+
+/* greedy LZ77: at each byte take the longest copy of earlier bytes,
+   the nearest on ties; returns the length, MSGSIZE if that is no shorter */
+static int lz_encode(const char *in, char *out)
+{
+  int i, j, len, best, offset = 0, lit = 0, n = 1;
+
+  out[0] = COMPRESS_LZ;
+  for (i = 0; i < MSGSIZE; ) {
+    best = 0;
+    for (j = i - 1; j >= 0; j--) {
+      for (len = 0; i + len < MSGSIZE && in[j + len] == in[i + len]; len++)
+        ;
+      if (len > best) {
+        best = len;
+        offset = i - j;
+      }
+    }
+    if (best < LZ_MINMATCH) {
+      i++;
+      continue;
+    }
+    if (!lz_literals(in, lit, i, out, &n) || n + 2 >= MSGSIZE)
+      return MSGSIZE;
+    out[n++] = (char)(LZ_MATCH | (best - LZ_MINMATCH));
+    out[n++] = (char)offset;
+    i += best;
+    lit = i;
+  }
+  if (!lz_literals(in, lit, MSGSIZE, out, &n))
+    return MSGSIZE;
+  return n;
+}
+
+static int lz_decode(const char *in, int length, char *out)
+{
+  int i = 1, j, t, len, offset, n = 0;
+
+  while (i < length) {
+    t = (unsigned char)in[i++];
+    if (t & LZ_MATCH) {
+      len = (t & ~LZ_MATCH) + LZ_MINMATCH;
+      if (i == length)
+        return -1;
+      offset = (unsigned char)in[i++];
+      if (offset == 0 || offset > n || n + len > MSGSIZE)
+        return -1;
+      for (j = 0; j < len; j++, n++)    /* copies may overlap themselves */
+        out[n] = out[n - offset];
+    }
+    else {
+      len = t + 1;
+      if (i + len > length || n + len > MSGSIZE)
+        return -1;
+      memcpy(out + n, in + i, len);
+      i += len;
+      n += len;
+    }
+  }
+  return n == MSGSIZE ? 0 : -1;
+}
+
+/* compress message in place, setting its length; bytes past the length
+   are zeroed so that they add nothing to the checksum or FEC parity */
+void compress_msg(struct msg *message)
+{
+  char out[MSGSIZE];
+  int n;
+
+  message->length = MSGSIZE;
+  if (compress_kind == COMPRESS_NONE)
+    return;
+  n = compress_kind == COMPRESS_RLE ? rle_encode(message->data, out) :
+                                      lz_encode(message->data, out);
+  st.messages++;
+  st.bytes += n;
+  if (n == MSGSIZE) {
+    st.raw++;
+    return;
+  }
+  memset(message->data, 0, MSGSIZE);
+  memcpy(message->data, out, n);
+  message->length = n;
+}
+
+/* the 20 bytes of a message from length bytes of payload; 0 if that
+   worked, -1 if the payload is malformed */
+int decompress(const char *data, int length, char out[20])
+{
+  int result = -1;
+
+  if (length == MSGSIZE) {
+    memcpy(out, data, MSGSIZE);
+    return 0;
+  }
+  if (length >= 2 && length < MSGSIZE) {
+    if (data[0] == COMPRESS_RLE)
+      result = rle_decode(data, length, out);
+    else if (data[0] == COMPRESS_LZ)
+      result = lz_decode(data, length, out);
+  }
+  if (result < 0)
+    st.failed++;
+  return result;
+}
+
+void compress_report(void)
+{
+  printf("compression: %s, %lld messages, mean payload %.2f of %d bytes, "
+         "sent raw: %lld, failed to decompress at B: %lld\n",
+         names[compress_kind], st.messages,
+         st.messages > 0 ? (double)st.bytes / st.messages : 0.0, MSGSIZE,
+         st.raw, st.failed);
+}
+
+void compress_checkpoint(struct ckpt *c)
+{
+  CKPT_IO(c, compress_kind);
+  CKPT_IO(c, st);
+}
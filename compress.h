@@ -0,0 +1,31 @@
+/* ******************************************************************
+   Payload compression between layer 5 and layer 4.  Each message from
+   layer 5 is compressed on its own before A's protocol sees it, and
+   what B's protocol delivers is decompressed before it reaches the
+   application, so the protocols just carry msg.length bytes of payload
+   and the channel charges the link for the header and those bytes only.
+
+     none  messages travel as the raw 20 bytes
+     rle   runs of a byte as (count, byte) pairs
+     lz    greedy LZ77 within the message: literal runs and
+           (length, offset) copies of earlier bytes, LZ4 style
+
+   A compressed payload starts with the codec that made it.  A message
+   the codec cannot shrink is sent raw, and a payload of the full 20
+   bytes is always raw, so B needs no option to read either.
+**********************************************************************/
+
+#define COMPRESS_NONE 0
+#define COMPRESS_RLE  1
+#define COMPRESS_LZ   2
+
+extern int compress_kind;
+
+extern int compress_byname(const char *name);
+extern void compress_reset(void);
+extern void compress_msg(struct msg *message);
+extern int decompress(const char *data, int length, char out[20]);
+extern void compress_report(void);
+
+struct ckpt;
+extern void compress_checkpoint(struct ckpt *c);
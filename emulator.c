@@ -33,14 +33,74 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Modifications:
+   - optional bottleneck link per direction (serialization rate, finite
+   FIFO, drop-tail/RED/CoDel), configured from the command line
+   - the clock is a 64-bit count of ticks (TICKS_PER_UNIT per time unit)
+   rather than a float, so event ordering stays exact on very long runs
+   - all counters are 64 bit, and an optional progress line reports the
+   simulated time, message rate and window occupancy while running
+   - the complete simulation state can be written to a snapshot at a
+   chosen simulated time and the run resumed later from that snapshot
+   - channel decisions can be recorded to a file and replayed from it,
+   so protocols can be compared over an identical impairment sequence
+   - protocols are reached through a descriptor (struct protocol), so SR
+   and GBN link into one binary; one is chosen by name at run time, or
+   the same scenario is run against each of them for a comparison
+   - packets can be routed over a multi-hop topology of routers with
+   background traffic, simulated in parallel over worker threads
+   - the latency of every delivered message is measured, and a scenario
+   can be replicated with independent seeds, in parallel processes,
+   until the confidence intervals of the results are narrow enough
+   - every message delivered at B is checked against the message A
+   accepted, and delivered data can be written to a file
+   - window occupancy, packets in flight, resends and receiver buffer
+   fill can be sampled at a fixed interval and written out as CSV
+   - packets can be carried over loopback UDP sockets instead of the
+   simulated channel, with timers and arrivals on the wall clock
+   - A and B can run in two processes joined by shared memory rings
+   - built with -DPROFILE, event dispatch, the handlers and the busiest
+   emulator routines count the cycles they take (see profile.h)
+   - optional XOR forward error correction: a parity packet after every
+   k packets from A lets B rebuild a single loss (see fec.h), and a
+   sweep over k and the loss probability tabulates goodput and latency
+   - messages can be spread over several streams, each delivered in
+   order on its own, with the latency of each stream reported
+   - message arrivals can follow a Poisson, Pareto on/off, saturating
+   or trace driven process instead of the uniform one (see workload.h)
+   - window, sequence space and timeout are run time parameters, and a
+   tuning mode searches them for the best goodput with successive halving
+   - messages can be compressed with RLE or LZ between layer 5 and the
+   protocol, and links charge only the bytes of payload sent (see compress.h)
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "emulator.h"
+#include "protocol.h"
+#include "sr.h"
 #include "gbn.h"
+#include "link.h"
+#include "checkpoint.h"
+#include "chanlog.h"
+#include "topo.h"
+#include "sink.h"
+#include "sampler.h"
+#include "udp.h"
+#include "shmchan.h"
+#include "profile.h"
+#include "fec.h"
+#include "workload.h"
+#include "compress.h"
 
 struct event {
-  float evtime;           /* event time */
+  simtime_t evtime;       /* event time, in ticks */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
@@ -61,40 +121,195 @@ struct event *evlist = NULL;   /* the event list */
 int TRACE = 3;
 
 /* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
+long long window_full;   /* count of the number of messages dropped due to full window */
+long long total_ACKs_received;
+long long packets_resent;       /* count of the number of packets resent  */
+long long new_ACKs;           /* count of the number of acks correctly received */
+long long packets_received;  /* count of the packets received by receiver */
 
 /* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
+static long long packets_lost;  
+static long long packets_corrupt;
+static long long packets_sent;
+static long long packets_timeout;
+static long long messages_delivered;
+
+/* messages A accepted that are still on their way, oldest first, since B
+   must deliver each stream in order: for latency and the delivery check */
+struct inflight {
+  simtime_t sent;                 /* time A accepted it */
+  long long msgno;                /* message number, from nsim */
+};
+struct stream {
+  struct inflight *inflight;
+  long long head, len, cap;
+  simtime_t latsum;               /* total latency of its delivered messages */
+  long long latcount;             /* number of latencies in latsum */
+};
+static struct stream streams[MAXSTREAMS];
+static int nstreams = 1;          /* message n goes to stream n % nstreams */
+static simtime_t latsum;          /* total latency of delivered messages */
+static long long latcount;        /* number of latencies in latsum */
+
+/* latencies binned on a log scale, for percentiles: bin i ends at
+   2^((i+1)/LATSTEPS - LATMIN) time units */
+#define LATSTEPS 16               /* bins per doubling */
+#define LATMIN   4                /* the first doubling starts at 2^-4 */
+#define LATBINS  (32 * LATSTEPS)
+static long long lathist[LATBINS];
+
+static int saturated = 0;         /* saturating source waiting for A to have room */
+static long long nsim = 0;        /* number of messages from 5 to 4 so far */ 
+static long long nsimmax = 0;     /* number of msgs to generate, then stop */
+static simtime_t now = 0;         /* current simulated time, in ticks */
 static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
 static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+static long long ntolayer3;       /* number sent into layer 3 */
+static long long nlost;           /* number lost in media */
+static long long ncorrupt;        /* number corrupted by media*/
+
+/* bottleneck link of each direction, indexed by the sending entity */
+static struct link links[2];
+static double linkrate = 0.0;     /* bytes per time unit, 0 = infinite */
+static int linkqlimit = 0;        /* FIFO size in packets, 0 = unlimited */
+static int linkaqm = AQM_DROPTAIL;
+
+/* progress reporting */
+static double progress = 0.0;     /* seconds between progress lines, 0 = off */
+static double lastreport;         /* wall clock time of the last progress line */
+static long long lastnsim;        /* nsim at the last progress line */
+static long long nevents;         /* events dispatched so far */
+#define PROGRESS_MASK 0xfff       /* look at the wall clock every 4096 events */
+
+/* the protocols linked into this binary */
+const struct protocol *protocols[] = { &sr_protocol, &gbn_protocol, NULL };
+
+static const struct protocol *proto = &sr_protocol;  /* protocol being run */
+static void *pstate;              /* its per-instance state */
+static struct protoparams params; /* window, seqspace, rtt asked for, 0 = default */
+static struct protoparams runparams;  /* ... and what the current run uses */
+static int compare = 0;           /* run every protocol and compare them */
+
+/* end of run figures of one protocol, for the comparison table */
+struct results {
+  const char *name;
+  simtime_t time;
+  long long nsim;
+  long long window_full;
+  long long new_ACKs;
+  long long packets_resent;
+  long long packets_received;
+  long long messages_delivered;
+  long long ntolayer3;
+  long long nlost;
+  long long ncorrupt;
+  long long violations;           /* failed delivery checks */
+  double latency;                 /* mean message latency, time units */
+  double p99;                     /* 99th percentile latency, time units */
+};
+
+/* checkpointing */
+#define SEED 9999                 /* seed of the random number generator */
+static char *ckptfile = NULL;     /* snapshot to write, if any */
+static simtime_t ckpttime = 0;    /* simulated time at which to write it */
+static char *restorefile = NULL;  /* snapshot to resume from, if any */
+
+/* replication */
+#define MINREPS 5                 /* never stop on fewer replications */
+static unsigned int seed = SEED;  /* seed of the current run */
+static long long maxreps = 0;     /* replication limit, 0 = single run */
+static double ciwidth = 0.05;     /* target CI half width, relative to the mean */
+static int nworkers = 1;          /* replications run at once */
+
+static char *sinkfile = NULL;     /* file to stream delivered data to, if any */
+
+static char *seriesfile = NULL;   /* CSV time series to write, if any */
+static double sampleinterval = 1.0;
+
+static double udpscale = 0.0;     /* microseconds per time unit over UDP, 0 = off */
+static double shmscale = 0.0;     /* the same for the two-process mode */
+
+/* auto-tuning */
+static int tune = 0;              /* search window, seqspace and timeout */
+#define TUNE_MINMSGS 100          /* messages in a first round run, at least */
+#define TUNE_SLACK   4            /* runs slower than this many times the
+                                     arrival time of their messages are cut */
+
+/* forward error correction sweep */
+#define MAXSWEEP 16
+static double sweepk[MAXSWEEP];   /* group sizes to try */
+static int nsweepk = 0;           /* 0 = no sweep */
+static double sweeploss[MAXSWEEP];/* loss probabilities to try */
+static int nsweeploss = 0;        /* 0 = the scenario's */
+
+/* one replication's results, sent back to the parent through a pipe */
+struct sample {
+  long long rep;
+  double goodput;
+  double resent;
+  double latency;
+};
+
+/* multi-hop topology */
+static char *topofile = NULL;     /* topology to route packets over, if any */
+static int topothreads = 1;       /* worker threads for the routers */
+
+/* the additive feedback generator behind glibc's rand(), kept here so that
+   its state is ours to snapshot; seeded alike it gives the same numbers, so
+   runs are unchanged */
+#define RNG_DEG   31
+#define RNG_SEP   3
+#define RNG_MAX   2147483647
+struct rng {
+  unsigned int r[RNG_DEG];
+  int front, rear;
+};
+
+static struct rng rng;
+
+static int rng_next(void)
+{
+  int x;
+
+  rng.r[rng.front] += rng.r[rng.rear];
+  x = rng.r[rng.front] >> 1;
+  rng.front = (rng.front + 1) % RNG_DEG;
+  rng.rear = (rng.rear + 1) % RNG_DEG;
+  return x;
+}
+
+static void rng_seed(unsigned int s)
+{
+  long word;
+  int i;
+
+  word = s == 0 ? 1 : (int)s;
+  rng.r[0] = word;
+  for (i = 1; i < RNG_DEG; i++) {
+    /* 16807 * word % RNG_MAX without overflow (Schrage) */
+    word = 16807 * (word % 127773) - 2836 * (word / 127773);
+    if (word < 0)
+      word += RNG_MAX;
+    rng.r[i] = word;
+  }
+  rng.front = RNG_SEP;
+  rng.rear = 0;
+  for (i = 0; i < 10 * RNG_DEG; i++)
+    rng_next();
+}
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* isolate all random number generation in one location.  rng_next()      */
+/* returns an int in the range [0,mmm]                                      */
 /****************************************************************************/
 double jimsrand(void) 
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+  double mmm = RNG_MAX;      /* largest int returned by rng_next() */
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  x = rng_next()/mmm;        /* x should be uniform in [0,1] */
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
@@ -107,10 +322,11 @@ double jimsrand(void)
 void insertevent(struct event *p)
 {
   struct event *q,*qold;
+  PROF_FUNC("insertevent");
 
   if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+    printf("            INSERTEVENT: time is %f\n",TICKS_TO_UNITS(now));
+    printf("            INSERTEVENT: future time will be %f\n",TICKS_TO_UNITS(p->evtime)); 
   }
   q = evlist;     /* q points to front of list in which p struct inserted */
   if (q==NULL) {   /* list is empty */
@@ -145,18 +361,24 @@ void generate_next_arrival(void)
 {
   double x;
   struct event *evptr;
+  PROF_FUNC("generate_next_arrival");
 
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
+  if (workload_kind == ARRIVE_SATURATE) {
+    saturated = 1;          /* offer() schedules it once A has room */
+    return;
+  }
+  x = workload_gap(TICKS_TO_UNITS(now), lambda);
+  if (x == WORKLOAD_NONE)
+    return;                 /* the trace has ended */
   evptr = malloc(sizeof(struct event));
   if (evptr == 0) {
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
   }
-  evptr->evtime =  time + x;
+  evptr->evtime =  now + UNITS_TO_TICKS(x);
   evptr->evtype =  FROM_LAYER5;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
@@ -165,24 +387,40 @@ void generate_next_arrival(void)
   insertevent(evptr);
 } 
 
+/* a saturating source offers the next message as soon as A has room */
+static void offer(void)
+{
+  struct event *evptr;
+
+  if (!saturated || nsim >= nsimmax || proto->A_occupancy(pstate) >= proto->A_window(pstate))
+    return;
+  saturated = 0;
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime = now;
+  evptr->evtype = FROM_LAYER5;
+  evptr->eventity = A;
+  insertevent(evptr);
+}
+
 void printevlist(void)
 {
   struct event *q;
   printf("--------------\nEvent List Follows:\n");
   for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+    printf("Event time: %f, type: %d entity: %d\n",TICKS_TO_UNITS(q->evtime),q->evtype,q->eventity);
   }
   printf("--------------\n");
 }
 
 void init(void)                         /* initialize the simulator */
 {
-  float sum, avg;
-  int i;
-
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
+  scanf("%lld",&nsimmax);
   printf("Enter  packet loss probability [enter 0.0 for no loss]:");
   scanf("%f",&lossprob);
   printf("Enter packet corruption probability [0.0 for no corruption]:");
@@ -195,9 +433,34 @@ void init(void)                         /* initialize the simulator */
   scanf("%f",&lambda);
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
+}
+
+/* the parameters to run pr with: those asked for, and the protocol's
+   defaults for the rest.  A window without a sequence space gets the
+   smallest sequence space the protocol accepts with it */
+static struct protoparams paramsfor(const struct protocol *pr)
+{
+  struct protoparams p = pr->defaults;
 
+  if (params.rtt > 0.0)
+    p.rtt = params.rtt;
+  if (params.window > 0) {
+    p.window = params.window;
+    for (p.seqspace = p.window + 1; p.seqspace < MAXSEQSPACE && !pr->params_ok(&p); p.seqspace++)
+      ;
+  }
+  if (params.seqspace > 0)
+    p.seqspace = params.seqspace;
+  return p;
+}
+
+/* reset everything a run changes, so the same scenario can be run again */
+static void startrun(void)
+{
+  float sum, avg;
+  int i;
 
-  srand(9999);              /* init random number generator */
+  rng_seed(seed);           /* init random number generator */
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -224,9 +487,42 @@ void init(void)                         /* initialize the simulator */
   ntolayer3 = 0;
   nlost = 0;
   ncorrupt = 0;
+  nsim = 0;
+  nevents = 0;
+  for (i = 0; i < MAXSTREAMS; i++) {
+    streams[i].head = streams[i].len = 0;
+    streams[i].latsum = 0;
+    streams[i].latcount = 0;
+  }
+  latsum = 0;
+  latcount = 0;
+  memset(lathist, 0, sizeof(lathist));
+  sink_reset();
+  sampler_reset(UNITS_TO_TICKS(nsimmax * lambda));
+  fec_reset();
+  compress_reset();
+  workload_reset();
+  saturated = 0;
+
+  link_init(&links[A], linkrate, linkqlimit, linkaqm, 2ULL * seed + A);
+  link_init(&links[B], linkrate, linkqlimit, linkaqm, 2ULL * seed + B);
+  chanlog_reset();
 
-  time=0.0;                    /* initialize time to 0.0 */
+  now=0;                       /* initialize time to 0.0 */
   generate_next_arrival();     /* initialize event list */
+  runparams = paramsfor(proto);
+  pstate = proto->create(&runparams);    /* A_init() and B_init() */
+  offer();
+}
+
+const struct protocol *protocol_byname(const char *name)
+{
+  int i;
+
+  for (i = 0; protocols[i] != NULL; i++)
+    if (strcmp(protocols[i]->name, name) == 0)
+      return protocols[i];
+  return NULL;
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -236,9 +532,10 @@ void stoptimer(int AorB)
 /* A or B is trying to stop timer */
 {
   struct event *q;
+  PROF_FUNC("stoptimer");
 
   if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
+    printf("          STOP TIMER: stopping timer at %f\n",TICKS_TO_UNITS(now));
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
   for (q=evlist; q!=NULL ; q = q->next) 
     if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
@@ -263,14 +560,21 @@ void stoptimer(int AorB)
 
 
 void starttimer(int AorB, double increment)
-/* A or B is trying to start timer */
+/* A or B is trying to start timer, increment in time units */
+{
+  starttimer_ticks(AorB, UNITS_TO_TICKS(increment));
+}
+
+void starttimer_ticks(int AorB, simtime_t increment)
+/* A or B is trying to start timer, increment in ticks */
 {
 
   struct event *q;
   struct event *evptr;
+  PROF_FUNC("starttimer");
 
   if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+    printf("          START TIMER: starting timer at %f\n",TICKS_TO_UNITS(now));
   /* be nice: check to see if timer is already started, if so, then  warn */
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
   for (q=evlist; q!=NULL ; q = q->next)  
@@ -285,7 +589,7 @@ void starttimer(int AorB, double increment)
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
   }
-  evptr->evtime =  time + increment;
+  evptr->evtime =  now + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
  
@@ -295,18 +599,65 @@ void starttimer(int AorB, double increment)
 
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+
+/* is the direction in which AorB sends subject to loss and corruption? */
+static int impaired(int AorB)
+{
+  return !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+}
+
+/* decide the whole fate of a packet up front, from the channel log or
+   from the channel's own random stream (recording it if asked to) */
+static void chandecide(int AorB, struct chandecision *d)
+{
+  double x;
+
+  if (chanlog_mode == CHANLOG_REPLAY && chanlog_get(AorB, d))
+    return;
+  d->lost = chanlog_rand() < lossprob && impaired(AorB);
+  d->delay = chanlog_quantize(1 + 9*chanlog_rand());
+  d->corrupt = CORRUPT_NONE;
+  if (chanlog_rand() < corruptprob && impaired(AorB)) {
+    if ((x = chanlog_rand()) < .75)
+      d->corrupt = CORRUPT_PAYLOAD;
+    else if (x < .875)
+      d->corrupt = CORRUPT_SEQNUM;
+    else
+      d->corrupt = CORRUPT_ACKNUM;
+  }
+  if (chanlog_mode == CHANLOG_RECORD)
+    chanlog_put(AorB, d);
+}
+
+static void channel(int AorB, struct pkt packet, int bytes)
+/* A or B is sending to network, bytes on the wire  */
 {
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
+  struct event *evptr = NULL, *q;
+  struct chandecision d;
+  simtime_t lastime, depart = 0;
+  double delay;
+  float x;
+  int i, corrupt;
+  PROF_FUNC("tolayer3");
 
   ntolayer3++;
 
+  /* when recording or replaying, the channel decides before anything else
+     so that decisions stay indexed by transmission order */
+  if (chanlog_mode != CHANLOG_OFF)
+    chandecide(AorB, &d);
+
+  /* queue at the bottleneck link, if there is one */
+  if (!topo_active && links[AorB].rate > 0.0 &&
+      link_send(&links[AorB], now, bytes, &depart) != LINK_SENT) {
+    if (TRACE>0)
+      printf("          TOLAYER3: packet dropped at link queue\n");
+    return;
+  }
+
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (chanlog_mode != CHANLOG_OFF ? d.lost : (jimsrand() < lossprob && impaired(AorB))) {
     nlost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
@@ -323,6 +674,9 @@ void tolayer3(int AorB, struct pkt packet)
   mypktptr->seqnum = packet.seqnum;
   mypktptr->acknum = packet.acknum;
   mypktptr->checksum = packet.checksum;
+  mypktptr->stream = packet.stream;
+  mypktptr->ssn = packet.ssn;
+  mypktptr->length = packet.length;
   for (i=0; i<20; i++)
     mypktptr->payload[i] = packet.payload[i];
   if (TRACE>2)  {
@@ -333,34 +687,57 @@ void tolayer3(int AorB, struct pkt packet)
     printf("\n");
   }
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  /* create future event for arrival of packet at the other side; with a
+     topology the hops decide when (and whether) it gets there, over UDP
+     the real network does, between processes the ring */
+  if (!topo_active && !udp_active && !shmchan_active) {
+    evptr = malloc(sizeof(struct event));
+    if (evptr == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
+    evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
+    evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+    /* finally, compute the arrival time of packet at the other end.
+       medium can not reorder, so make sure packet arrives between 1 and 10
+       time units after the latest arrival time of packets
+       currently in the medium on their way to the destination */
+    lastime = now;
+    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
+    for (q=evlist; q!=NULL ; q = q->next) 
+      if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
+        lastime = q->evtime;
+    delay = (chanlog_mode != CHANLOG_OFF) ? d.delay : 1 + 9*jimsrand();
+    if (links[AorB].rate > 0.0) {
+      /* finite link: propagate from the moment the packet is clocked out,
+         but still never overtake a packet already in the medium */
+      evptr->evtime =  depart + UNITS_TO_TICKS(delay);
+      if (evptr->evtime < lastime)
+        evptr->evtime = lastime;
+    }
+    else
+      evptr->evtime =  lastime + UNITS_TO_TICKS(delay);
   }
-  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
-  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
-
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
+  if (chanlog_mode != CHANLOG_OFF)
+    corrupt = d.corrupt;
+  else if ((jimsrand() < corruptprob) && impaired(AorB)) {
     if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
+      corrupt = CORRUPT_PAYLOAD;
     else if (x < .875)
+      corrupt = CORRUPT_SEQNUM;
+    else
+      corrupt = CORRUPT_ACKNUM;
+  }
+  else
+    corrupt = CORRUPT_NONE;
+  if (corrupt != CORRUPT_NONE) {
+    ncorrupt++;
+    if (corrupt == CORRUPT_PAYLOAD)
+      mypktptr->payload[0]='Z';   /* corrupt payload */
+    else if (corrupt == CORRUPT_SEQNUM)
       mypktptr->seqnum = 999999;
     else
       mypktptr->acknum = 999999;
@@ -368,14 +745,116 @@ void tolayer3(int AorB, struct pkt packet)
       printf("          TOLAYER3: packet being corrupted\n");
   }  
 
+  if (topo_active || udp_active || shmchan_active) {
+    if (topo_active)
+      topo_inject(AorB, mypktptr, bytes, now);
+    else if (udp_active)
+      udp_send(AorB, mypktptr);
+    else
+      shmchan_send(AorB, mypktptr, now);
+    free(mypktptr);
+    return;
+  }
+
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
   insertevent(evptr);
 } 
 
+void tolayer3(int AorB, struct pkt packet)
+{
+  struct pkt parity;
+  int bytes;
+
+  channel(AorB, packet, PKT_HEADER + packet.length);
+  if (fec_group > 0 && AorB == A && fec_output(&packet, &parity, &bytes)) {
+    if (TRACE>2)
+      printf("          TOLAYER3: sending FEC parity packet\n");
+    channel(A, parity, PKT_HEADER + bytes);
+  }
+}
+
+/* histogram bin of a latency */
+static int latbin(simtime_t latency)
+{
+  double x;
+
+  if (latency <= 0)
+    return 0;
+  x = (log2(TICKS_TO_UNITS(latency)) + LATMIN) * LATSTEPS;
+  if (x < 0)
+    return 0;
+  return x >= LATBINS ? LATBINS - 1 : (int)x;
+}
+
+/* latency below which a fraction q of the delivered messages came, to
+   within a bin (about 4%) */
+static double latpercentile(double q)
+{
+  long long n = 0;
+  int i;
+
+  if (latcount == 0)
+    return 0.0;
+  for (i = 0; i < LATBINS - 1; i++) {
+    n += lathist[i];
+    if (n >= q * latcount)
+      break;
+  }
+  return exp2((double)(i + 1) / LATSTEPS - LATMIN);
+}
+
+/* remember that A accepted a message of stream st */
+static void inflight_push(struct stream *st, simtime_t t, long long msgno)
+{
+  struct inflight *grown;
+  long long i;
+
+  if (st->len == st->cap) {
+    grown = malloc((st->cap ? 2 * st->cap : 256) * sizeof(struct inflight));
+    if (grown == NULL) {
+      printf("memory allocation for latency failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < st->len; i++)
+      grown[i] = st->inflight[(st->head + i) % st->cap];
+    free(st->inflight);
+    st->inflight = grown;
+    st->head = 0;
+    st->cap = st->cap ? 2 * st->cap : 256;
+  }
+  st->inflight[(st->head + st->len) % st->cap].sent = t;
+  st->inflight[(st->head + st->len) % st->cap].msgno = msgno;
+  st->len++;
+}
+
+/* messages accepted by A and not delivered yet, over all streams */
+static long long undelivered(void)
+{
+  long long n = 0;
+  int i;
+
+  for (i = 0; i < MAXSTREAMS; i++)
+    n += streams[i].len;
+  return n;
+}
+
 void tolayer5(int AorB, char datasent[20])
 {
+  tolayer5_stream(AorB, 0, datasent, 20);
+}
+
+void tolayer5_stream(int AorB, int stream, char datasent[20], int length)
+{
+  struct stream *st;
+  simtime_t latency;
+  char plain[20];
   int i;  
+  PROF_FUNC("tolayer5");
+  /* a payload that does not decompress goes up as it is, for the
+     delivery check to catch */
+  if (length != 20 && decompress(datasent, length, plain) == 0)
+    datasent = plain;
   if (TRACE>2) {
     printf("          TOLAYER5: data received by application at ");
     if (AorB == A) 
@@ -387,92 +866,1172 @@ void tolayer5(int AorB, char datasent[20])
     printf("\n");
   }
   messages_delivered++;
+  if (shmchan_active)
+    return;                     /* A's process holds the messages in flight */
+  st = (stream >= 0 && stream < MAXSTREAMS) ? &streams[stream] : NULL;
+  if (AorB == B && st != NULL && st->len > 0) {
+    latency = now - st->inflight[st->head].sent;
+    latsum += latency;
+    latcount++;
+    lathist[latbin(latency)]++;
+    st->latsum += latency;
+    st->latcount++;
+    sink_deliver(st->inflight[st->head].msgno, datasent, now);
+    st->head = (st->head + 1) % st->cap;
+    st->len--;
+  }
+  else if (AorB == B)
+    sink_deliver(SINK_NONE, datasent, now);
+}
+
+/* save or restore everything the emulator itself knows about the run:
+   scenario, clock, counters, random number state, links and events */
+static void checkpoint(struct ckpt *c)
+{
+  struct event *q, *tail;
+  struct inflight sent;
+  long long n, count;
+  int version = CKPT_VERSION;
+  int haspkt, i;
+  char name[16];
+
+  ckpt_tag(c, CKPT_MAGIC);
+  CKPT_IO(c, version);
+  if (version != CKPT_VERSION) {
+    printf("checkpoint %s: unsupported version %d\n", c->name, version);
+    exit(EXIT_FAILURE);
+  }
+
+  /* scenario */
+  memset(name, 0, sizeof(name));
+  strncpy(name, proto->name, sizeof(name) - 1);
+  CKPT_IO(c, name);
+  if (!CKPT_SAVING(c)) {
+    name[sizeof(name) - 1] = '\0';
+    if ((proto = protocol_byname(name)) == NULL) {
+      printf("checkpoint %s: unknown protocol %s\n", c->name, name);
+      exit(EXIT_FAILURE);
+    }
+  }
+  CKPT_IO(c, runparams);
+  if (!CKPT_SAVING(c)) {
+    if (!proto->params_ok(&runparams)) {
+      printf("checkpoint %s: parameters not usable with %s\n", c->name, proto->name);
+      exit(EXIT_FAILURE);
+    }
+    pstate = proto->create(&runparams);
+  }
+  CKPT_IO(c, nsimmax);
+  CKPT_IO(c, lossprob);
+  CKPT_IO(c, corruptprob);
+  CKPT_IO(c, corruptdirection);
+  CKPT_IO(c, lambda);
+  CKPT_IO(c, TRACE);
+
+  /* clock and counters */
+  CKPT_IO(c, now);
+  CKPT_IO(c, nsim);
+  CKPT_IO(c, nevents);
+  CKPT_IO(c, window_full);
+  CKPT_IO(c, total_ACKs_received);
+  CKPT_IO(c, packets_resent);
+  CKPT_IO(c, new_ACKs);
+  CKPT_IO(c, packets_received);
+  CKPT_IO(c, packets_lost);
+  CKPT_IO(c, packets_corrupt);
+  CKPT_IO(c, packets_sent);
+  CKPT_IO(c, packets_timeout);
+  CKPT_IO(c, messages_delivered);
+  CKPT_IO(c, ntolayer3);
+  CKPT_IO(c, nlost);
+  CKPT_IO(c, ncorrupt);
+  CKPT_IO(c, latsum);
+  CKPT_IO(c, latcount);
+  CKPT_IO(c, lathist);
+  CKPT_IO(c, nstreams);
+  for (i = 0; i < MAXSTREAMS; i++) {
+    CKPT_IO(c, streams[i].latsum);
+    CKPT_IO(c, streams[i].latcount);
+    n = streams[i].len;
+    CKPT_IO(c, n);
+    for (count = 0; count < n; count++) {
+      if (CKPT_SAVING(c))
+        CKPT_IO(c, streams[i].inflight[(streams[i].head + count) % streams[i].cap]);
+      else {
+        CKPT_IO(c, sent);
+        inflight_push(&streams[i], sent.sent, sent.msgno);
+      }
+    }
+  }
+  sink_checkpoint(c);
+  CKPT_IO(c, fec_group);
+  fec_checkpoint(c);
+  compress_checkpoint(c);
+  CKPT_IO(c, saturated);
+  workload_checkpoint(c);
+
+  CKPT_IO(c, rng);
+
+  CKPT_IO(c, linkrate);
+  CKPT_IO(c, linkqlimit);
+  CKPT_IO(c, linkaqm);
+  link_checkpoint(c, &links[A]);
+  link_checkpoint(c, &links[B]);
+  chanlog_checkpoint(c);
+
+  /* event list, in time order */
+  if (CKPT_SAVING(c)) {
+    for (count = 0, q = evlist; q != NULL; q = q->next)
+      count++;
+    CKPT_IO(c, count);
+    for (q = evlist; q != NULL; q = q->next) {
+      haspkt = (q->evtype == FROM_LAYER3);
+      CKPT_IO(c, q->evtime);
+      CKPT_IO(c, q->evtype);
+      CKPT_IO(c, q->eventity);
+      if (haspkt)
+        CKPT_IO(c, *q->pktptr);
+    }
+  }
+  else {
+    CKPT_IO(c, count);
+    for (tail = NULL, n = 0; n < count; n++) {
+      q = malloc(sizeof(struct event));
+      if (q == NULL) {
+        printf("memory allocation for event failed.");
+        exit(EXIT_FAILURE);
+      }
+      CKPT_IO(c, q->evtime);
+      CKPT_IO(c, q->evtype);
+      CKPT_IO(c, q->eventity);
+      q->pktptr = NULL;
+      if (q->evtype == FROM_LAYER3) {
+        q->pktptr = malloc(sizeof(struct pkt));
+        if (q->pktptr == NULL) {
+          printf("memory allocation for event failed.");
+          exit(EXIT_FAILURE);
+        }
+        CKPT_IO(c, *q->pktptr);
+      }
+      q->prev = tail;
+      q->next = NULL;
+      if (tail == NULL)
+        evlist = q;
+      else
+        tail->next = q;
+      tail = q;
+    }
+  }
+
+  proto->checkpoint(pstate, c);
+}
+
+static void savesnapshot(void)
+{
+  struct ckpt c;
+
+  ckpt_create(&c, ckptfile);
+  checkpoint(&c);
+  ckpt_close(&c);
+  if (TRACE>0)
+    printf("          CHECKPOINT: snapshot written to %s at time %f\n",
+           ckptfile, TICKS_TO_UNITS(now));
+}
+
+static void restoresnapshot(void)
+{
+  struct ckpt c;
+
+  ckpt_open(&c, restorefile);
+  checkpoint(&c);
+  ckpt_close(&c);
+  printf("-----  Resuming from snapshot %s at time %f -------- \n",
+         restorefile, TICKS_TO_UNITS(now));
+}
+
+/* wall clock time in seconds, only used for progress reports */
+static double wallclock(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* print a progress line if the report interval has passed.  Called every
+   PROGRESS_MASK+1 events so the clock read stays off the fast path. */
+static void progressreport(void)
+{
+  double wall = wallclock();
+
+  if (wall - lastreport < progress)
+    return;
+  fprintf(stderr, "progress: time %f, msgs %lld, %.0f msgs/s, window %d\n",
+          TICKS_TO_UNITS(now), nsim, (nsim - lastnsim) / (wall - lastreport),
+          proto->A_occupancy(pstate));
+  lastreport = wall;
+  lastnsim = nsim;
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-r rate] [-q qlimit] [-a droptail|red|codel] [-p seconds]\n"
+         "          [-c file -t time] [-R file] [-W file | -U file] [-P name | -C]\n"
+         "          [-T file [-j threads]] [-n runs [-e width] [-k procs]] [-o file]\n"
+         "          [-S file [-s interval]] [-u usec | -m usec] [-f k | -F ks [-L losses]]\n"
+         "          [-N streams] [-w process | -l file] [-X window[,seqspace[,timeout]]] [-A]\n"
+         "          [-z codec]\n", prog);
+  printf("  -r rate    bottleneck link rate in bytes per time unit (0 = infinite)\n");
+  printf("  -q qlimit  link FIFO size in packets (0 = unlimited)\n");
+  printf("  -a aqm     queue management at the link\n");
+  printf("  -p secs    print a progress line to stderr every secs of wall clock time\n");
+  printf("  -c file    write a snapshot of the simulation to file ...\n");
+  printf("  -t time    ... once the simulated time passes time\n");
+  printf("  -R file    resume from a snapshot instead of reading a scenario\n");
+  printf("  -P name    protocol to run: sr (default) or gbn\n");
+  printf("  -C         run the scenario against every protocol and compare them\n");
+  printf("  -W file    record every channel decision to file\n");
+  printf("  -U file    replay channel decisions recorded in file\n");
+  printf("  -T file    route packets over the multi-hop topology in file\n");
+  printf("  -j threads worker threads for the topology's routers (default 1)\n");
+  printf("  -n runs    replicate with independent seeds, at most runs times, ...\n");
+  printf("  -e width   ... until each 95%% CI half width is below width * mean (0.05)\n");
+  printf("  -k procs   replications to run in parallel (default 1)\n");
+  printf("  -o file    write the data delivered to B's layer 5 to file\n");
+  printf("  -S file    write a CSV time series of the sender and channel state ...\n");
+  printf("  -s time    ... sampled every time units (default 1)\n");
+  printf("  -u usec    carry packets over loopback UDP, one time unit lasting usec\n");
+  printf("  -m usec    run A and B in two processes joined by shared memory rings\n");
+  printf("  -f k       send an XOR parity packet after every k packets from A\n");
+  printf("  -F ks      run once for each k in the comma separated list ...\n");
+  printf("  -L losses  ... and each loss probability, and tabulate the results\n");
+  printf("  -N streams spread messages round robin over this many ordered streams\n");
+  printf("  -w process message arrivals: uniform, poisson, onoff or saturate\n");
+  printf("  -l file    replay message arrival times and sizes from a trace\n");
+  printf("  -X w,s,t   window, sequence space and timeout of the protocol (0 = default)\n");
+  printf("  -A         search window, sequence space and timeout for the best goodput\n");
+  printf("  -z codec   compress messages: none (default), rle or lz\n");
+  exit(EXIT_FAILURE);
+}
+
+/* comma separated numbers, at most MAXSWEEP; returns how many, 0 if malformed */
+static int parselist(const char *arg, double *values)
+{
+  char *end;
+  int n = 0;
+
+  while (n < MAXSWEEP) {
+    values[n++] = strtod(arg, &end);
+    if (end == arg)
+      return 0;
+    if (*end == '\0')
+      return n;
+    if (*end != ',')
+      return 0;
+    arg = end + 1;
+  }
+  return 0;
 }
 
-int main(void)
+/* parse the optional command line switches; the scenario itself is still
+   read from standard input by init() */
+static void parseargs(int argc, char *argv[])
+{
+  struct protoparams pp;
+  double x[MAXSWEEP];
+  int i, n;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-C") == 0) {
+      compare = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "-A") == 0) {
+      tune = 1;
+      continue;
+    }
+    if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+      usage(argv[0]);
+    switch (argv[i][1]) {
+    case 'r':
+      linkrate = atof(argv[++i]);
+      break;
+    case 'q':
+      linkqlimit = atoi(argv[++i]);
+      break;
+    case 'a':
+      if ((linkaqm = link_aqm_byname(argv[++i])) < 0)
+        usage(argv[0]);
+      break;
+    case 'p':
+      progress = atof(argv[++i]);
+      break;
+    case 'c':
+      ckptfile = argv[++i];
+      break;
+    case 't':
+      ckpttime = UNITS_TO_TICKS(atof(argv[++i]));
+      break;
+    case 'R':
+      restorefile = argv[++i];
+      break;
+    case 'P':
+      if ((proto = protocol_byname(argv[++i])) == NULL)
+        usage(argv[0]);
+      break;
+    case 'n':
+      maxreps = atoll(argv[++i]);
+      break;
+    case 'e':
+      ciwidth = atof(argv[++i]);
+      break;
+    case 'k':
+      if ((nworkers = atoi(argv[++i])) < 1)
+        usage(argv[0]);
+      break;
+    case 'o':
+      sinkfile = argv[++i];
+      break;
+    case 'S':
+      seriesfile = argv[++i];
+      break;
+    case 's':
+      sampleinterval = atof(argv[++i]);
+      break;
+    case 'w':
+      if (workload_kind == ARRIVE_TRACE ||
+          (workload_kind = workload_byname(argv[++i])) < 0 || workload_kind == ARRIVE_TRACE)
+        usage(argv[0]);
+      break;
+    case 'z':
+      if ((compress_kind = compress_byname(argv[++i])) < 0)
+        usage(argv[0]);
+      break;
+    case 'l':
+      if (workload_kind != ARRIVE_UNIFORM)
+        usage(argv[0]);
+      workload_open(argv[++i]);
+      break;
+    case 'X':
+      n = parselist(argv[++i], x);
+      if (n == 0 || n > 3)
+        usage(argv[0]);
+      params.window = (int)x[0];
+      params.seqspace = n > 1 ? (int)x[1] : 0;
+      params.rtt = n > 2 ? x[2] : 0.0;
+      break;
+    case 'N':
+      nstreams = atoi(argv[++i]);
+      break;
+    case 'f':
+      fec_group = atoi(argv[++i]);
+      break;
+    case 'F':
+      if ((nsweepk = parselist(argv[++i], sweepk)) == 0)
+        usage(argv[0]);
+      break;
+    case 'L':
+      if ((nsweeploss = parselist(argv[++i], sweeploss)) == 0)
+        usage(argv[0]);
+      break;
+    case 'u':
+      udpscale = atof(argv[++i]);
+      break;
+    case 'm':
+      shmscale = atof(argv[++i]);
+      break;
+    case 'T':
+      topofile = argv[++i];
+      break;
+    case 'j':
+      topothreads = atoi(argv[++i]);
+      break;
+    case 'W':
+      chanlog_open(CHANLOG_RECORD, argv[++i]);
+      break;
+    case 'U':
+      chanlog_open(CHANLOG_REPLAY, argv[++i]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (compare && (ckptfile != NULL || restorefile != NULL || chanlog_mode == CHANLOG_RECORD)) {
+    printf("-C cannot be combined with -c, -R or -W\n");
+    exit(EXIT_FAILURE);
+  }
+  if (maxreps > 0 && (compare || ckptfile != NULL || restorefile != NULL ||
+                     chanlog_mode != CHANLOG_OFF)) {
+    printf("-n cannot be combined with -C, -c, -R, -W or -U\n");
+    exit(EXIT_FAILURE);
+  }
+  for (n = 0; protocols[n] != NULL; n++) {
+    pp = paramsfor(protocols[n]);
+    if ((compare || protocols[n] == proto) && !protocols[n]->params_ok(&pp)) {
+      printf("window %d, sequence space %d and timeout %g are not usable with %s\n",
+             pp.window, pp.seqspace, pp.rtt, protocols[n]->name);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (tune && (compare || maxreps > 0 || nsweepk > 0 || restorefile != NULL || ckptfile != NULL ||
+               chanlog_mode == CHANLOG_RECORD || topofile != NULL || udpscale != 0.0 ||
+               shmscale != 0.0 || sinkfile != NULL || seriesfile != NULL)) {
+    printf("-A cannot be combined with -C, -n, -F, -R, -c, -W, -T, -u, -m, -o or -S\n");
+    exit(EXIT_FAILURE);
+  }
+  if (nstreams < 1 || nstreams > MAXSTREAMS) {
+    printf("number of streams must be between 1 and %d\n", MAXSTREAMS);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nsweepk; i++)
+    if (sweepk[i] < 0 || sweepk[i] > FEC_MAXGROUP)
+      fec_group = -1;
+  if (fec_group < 0 || fec_group > FEC_MAXGROUP) {
+    printf("FEC group size must be between 0 and %d\n", FEC_MAXGROUP);
+    exit(EXIT_FAILURE);
+  }
+  if (nsweepk > 0 && (compare || maxreps > 0 || restorefile != NULL || ckptfile != NULL ||
+                     chanlog_mode == CHANLOG_RECORD)) {
+    printf("-F cannot be combined with -C, -n, -R, -c or -W\n");
+    exit(EXIT_FAILURE);
+  }
+  if (sinkfile != NULL) {
+    if (compare || maxreps > 0 || restorefile != NULL) {
+      printf("-o cannot be combined with -C, -n or -R\n");
+      exit(EXIT_FAILURE);
+    }
+    sink_open(sinkfile);
+  }
+  if (seriesfile != NULL) {
+    if (compare || maxreps > 0 || restorefile != NULL) {
+      printf("-S cannot be combined with -C, -n or -R\n");
+      exit(EXIT_FAILURE);
+    }
+    sampler_open(seriesfile, sampleinterval);
+  }
+  if (topofile != NULL) {
+    if (ckptfile != NULL || restorefile != NULL || linkrate > 0.0) {
+      printf("-T cannot be combined with -c, -R or -r\n");
+      exit(EXIT_FAILURE);
+    }
+    topo_load(topofile, topothreads);
+  }
+  if (udpscale != 0.0) {
+    if (topofile != NULL || ckptfile != NULL || restorefile != NULL || linkrate > 0.0 ||
+        maxreps > 0) {
+      printf("-u cannot be combined with -T, -c, -R, -r or -n\n");
+      exit(EXIT_FAILURE);
+    }
+    udp_open(udpscale);
+  }
+  if (shmscale != 0.0) {
+    if (topofile != NULL || udpscale != 0.0 || ckptfile != NULL || restorefile != NULL ||
+        linkrate > 0.0 || maxreps > 0 || sinkfile != NULL || seriesfile != NULL) {
+      printf("-m cannot be combined with -T, -u, -c, -R, -r, -n, -o or -S\n");
+      exit(EXIT_FAILURE);
+    }
+    shmchan_open(shmscale);
+  }
+}
+
+/* record the state at every sample point before time upto */
+static void takesamples(simtime_t upto)
+{
+  struct tsample s;
+  struct event *q;
+
+  s.window = proto->A_occupancy(pstate);
+  s.inflight[A] = s.inflight[B] = 0;
+  for (q = evlist; q != NULL; q = q->next)
+    if (q->evtype == FROM_LAYER3)
+      s.inflight[1 - q->eventity]++;
+  if (topo_active) {
+    s.inflight[A] += topo_intransit(A);
+    s.inflight[B] += topo_intransit(B);
+  }
+  s.resends = packets_resent;
+  s.rxbuffer = proto->B_occupancy(pstate);
+  sampler_record(upto, &s);
+}
+
+static void dispatch(struct event *eventptr);
+
+/* dispatch events earlier than horizon */
+static void rununtil(simtime_t horizon)
 {
   struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
+
   while (1) {
     eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
+    if (eventptr==NULL || eventptr->evtime >= horizon)
+      return;
+    if (eventptr->evtime > sample_next)
+      takesamples(eventptr->evtime);
+    if (ckptfile != NULL && eventptr->evtime > ckpttime) {
+      savesnapshot();             /* state as of just before this event */
+      ckptfile = NULL;
+    }
     evlist = evlist->next;        /* remove this event from event list */
     if (evlist!=NULL)
       evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
+    if (progress > 0.0 && (++nevents & PROGRESS_MASK) == 0)
+      progressreport();
+    dispatch(eventptr);
+  }
+}
+
+/* hand one event, already off the list, to the entity it is for */
+static void dispatch(struct event *eventptr)
+{
+  struct msg  msg2give;
+  struct pkt  pkt2give, rebuilt;
+  long long full;
+  int i,j;
+  PROF_FUNC("event dispatch");
+
+  if (TRACE>=2) {
+    printf("\nEVENT time: %f,",TICKS_TO_UNITS(eventptr->evtime));
+    printf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      printf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      printf(", fromlayer5 ");
+    else
+      printf(", fromlayer3 ");
+    printf(" entity: %d\n",eventptr->eventity);
+  }
+  now = eventptr->evtime;         /* update time to next event time */
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if (nsim < nsimmax) {
+      generate_next_arrival();   /* set up future arrival */
+      /* fill in msg to give with string of same letter */    
+      j = nsim % 26; 
+      for (i=0; i<20; i++)  
+        msg2give.data[i] = 97 + j;
+      msg2give.stream = nsim % nstreams;
+      if (TRACE>2) {
+        printf("          MAINLOOP: data given to student: ");
+        for (i=0; i<20; i++) 
+          printf("%c", msg2give.data[i]);
+        printf("\n");
+      }
+      compress_msg(&msg2give);
+      nsim++;
+      if (eventptr->eventity == A && shmchan_active)
+        PROF_CALL("A_output", proto->A_output(pstate, msg2give));
+      else if (eventptr->eventity == A) {
+        /* the message is on its way unless the window was full */
+        full = window_full;
+        inflight_push(&streams[msg2give.stream], now, nsim - 1);
+        PROF_CALL("A_output", proto->A_output(pstate, msg2give));
+        if (window_full != full)
+          streams[msg2give.stream].len--;
       }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
+      else
+        PROF_CALL("B_output", proto->B_output(pstate, msg2give));
     }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
+    else if (TRACE > 2)
+        printf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+    pkt2give.seqnum = eventptr->pktptr->seqnum;
+    pkt2give.acknum = eventptr->pktptr->acknum;
+    pkt2give.checksum = eventptr->pktptr->checksum;
+    pkt2give.stream = eventptr->pktptr->stream;
+    pkt2give.ssn = eventptr->pktptr->ssn;
+    pkt2give.length = eventptr->pktptr->length;
+    for (i=0; i<20; i++)  
+      pkt2give.payload[i] = eventptr->pktptr->payload[i];
 	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
+      PROF_CALL("A_input", proto->A_input(pstate, pkt2give));   /* appropriate entity */
+    else if (fec_group > 0) {
+      /* parity never reaches B; a packet it rebuilt does */
+      j = fec_input(&pkt2give, &rebuilt, proto, pstate);
+      if (j == FEC_PASS)
+        PROF_CALL("B_input", proto->B_input(pstate, pkt2give));
+      else if (j == FEC_REBUILT)
+        PROF_CALL("B_input", proto->B_input(pstate, rebuilt));
+    }
+    else
+      PROF_CALL("B_input", proto->B_input(pstate, pkt2give));
 	    free(eventptr->pktptr);          /* free the memory for packet */
+  }
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    if (eventptr->eventity == A) 
+      PROF_CALL("A_timerinterrupt", proto->A_timerinterrupt(pstate));
+    else
+      PROF_CALL("B_timerinterrupt", proto->B_timerinterrupt(pstate));
+  }
+  else  {
+    printf("INTERNAL PANIC: unknown event type \n");
+  }
+  free(eventptr);
+  offer();                        /* the window may have opened */
+}
+
+/* topology and UDP backend hooks: time of the next event, and a packet
+   arriving at A or B after crossing the network */
+static simtime_t nextevent(void)
+{
+  return evlist != NULL ? evlist->evtime : SIMTIME_MAX;
+}
+
+static void netdeliver(int AorB, struct pkt *packet, simtime_t when)
+{
+  struct event *evptr, *q, *qold;
+
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0 || (evptr->pktptr = malloc(sizeof(struct pkt))) == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  *evptr->pktptr = *packet;
+  evptr->evtype = FROM_LAYER3;
+  evptr->eventity = AorB;
+  evptr->evtime = when;
+
+  /* unlike insertevent(), queue behind events at the same time, so packets
+     arriving together are handed over in the order they arrived */
+  for (q = evlist, qold = NULL; q != NULL && q->evtime <= when; q = q->next)
+    qold = q;
+  evptr->prev = qold;
+  evptr->next = q;
+  if (qold == NULL)
+    evlist = evptr;
+  else
+    qold->next = evptr;
+  if (q != NULL)
+    q->prev = evptr;
+}
+
+/* two-process mode: B's process drops the events it inherited from A's,
+   and hands back the counters only it has seen */
+static void clearevents(void)
+{
+  struct event *q;
+
+  saturated = 0;              /* only A's process offers messages */
+  while ((q = evlist) != NULL) {
+    evlist = q->next;
+    if (q->evtype == FROM_LAYER3)
+      free(q->pktptr);
+    free(q);
+  }
+}
+
+static void collect(struct shmchan_peerstats *s)
+{
+  s->packets_received = packets_received;
+  s->messages_delivered = messages_delivered;
+}
+
+static const struct topo_hooks topohooks = { nextevent, rununtil, netdeliver };
+static const struct udp_hooks udphooks = { nextevent, rununtil, netdeliver };
+static const struct shmchan_hooks shmhooks = { nextevent, rununtil, netdeliver, clearevents, collect };
+
+/* run the simulation until no events are left */
+static void simulate(void)
+{
+  struct shmchan_peerstats peer;
+
+  lastreport = wallclock();
+  lastnsim = nsim;
+  if (topo_active)
+    topo_run(&topohooks, seed);
+  else if (udp_active)
+    udp_run(&udphooks);
+  else if (shmchan_active) {
+    shmchan_run(&shmhooks, &peer);
+    packets_received += peer.packets_received;
+    messages_delivered += peer.messages_delivered;
+  }
+  else
+    rununtil(SIMTIME_MAX);
+}
+
+/* print the end of run summary and release the run's resources */
+static void endrun(struct results *res)
+{
+  int i;
+
+  printf(" Simulator terminated at time %f\n after attempting to send %lld msgs from layer5\n",TICKS_TO_UNITS(now),nsim);
+  printf("number of messages dropped due to full window:  %lld \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %lld \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %lld \n", packets_resent);
+  printf("number of correct packets received at B:  %lld \n", packets_received);
+  printf("number of messages delivered to application:  %lld \n", messages_delivered);
+  if (linkrate > 0.0) {
+    link_report(&links[A], "A->B", now);
+    link_report(&links[B], "B->A", now);
+  }
+  if (topo_active)
+    topo_report(now);
+  if (udp_active) {
+    udp_report();
+    printf("udp: mean message latency %f us\n",
+           latcount > 0 ? TICKS_TO_UNITS(latsum) / latcount * udpscale : 0.0);
+  }
+  if (shmchan_active)
+    shmchan_report();
+  if (fec_group > 0)
+    fec_report();
+  workload_report();
+  if (compress_kind != COMPRESS_NONE)
+    compress_report();
+  if (nstreams > 1 && !shmchan_active)
+    for (i = 0; i < nstreams; i++)
+      printf("stream %d: %lld messages delivered, mean latency %f\n", i,
+             streams[i].latcount,
+             streams[i].latcount > 0 ?
+             TICKS_TO_UNITS(streams[i].latsum) / streams[i].latcount : 0.0);
+  sink_finish(undelivered());
+  sink_report();
+  if (seriesfile != NULL) {
+    takesamples(now + 1);
+    sampler_write();
+  }
+
+  res->name = proto->name;
+  res->time = now;
+  res->nsim = nsim;
+  res->window_full = window_full;
+  res->new_ACKs = new_ACKs;
+  res->packets_resent = packets_resent;
+  res->packets_received = packets_received;
+  res->messages_delivered = messages_delivered;
+  res->ntolayer3 = ntolayer3;
+  res->nlost = nlost;
+  res->ncorrupt = ncorrupt;
+  res->violations = sink_violations();
+  res->latency = latcount > 0 ? TICKS_TO_UNITS(latsum) / latcount : 0.0;
+  res->p99 = latpercentile(0.99);
+
+  link_free(&links[A]);
+  link_free(&links[B]);
+  proto->destroy(pstate);
+  pstate = NULL;
+}
+
+/* print the results of several protocols side by side */
+static void comparison(struct results *res, int n)
+{
+  int i;
+
+#define ROW(label, field)                          \
+  do {                                             \
+    printf("%-34s", label);                        \
+    for (i = 0; i < n; i++)                        \
+      printf(" %14lld", res[i].field);             \
+    printf("\n");                                  \
+  } while (0)
+
+  printf("\n-----  Protocol comparison -------- \n\n");
+  printf("%-34s", "");
+  for (i = 0; i < n; i++)
+    printf(" %14s", res[i].name);
+  printf("\n%-34s", "simulated time");
+  for (i = 0; i < n; i++)
+    printf(" %14.3f", TICKS_TO_UNITS(res[i].time));
+  printf("\n");
+  ROW("messages from layer5", nsim);
+  ROW("dropped due to full window", window_full);
+  ROW("valid ACKs received at A", new_ACKs);
+  ROW("packet resends by A", packets_resent);
+  ROW("correct packets received at B", packets_received);
+  ROW("messages delivered", messages_delivered);
+  ROW("packets sent into layer3", ntolayer3);
+  ROW("packets lost", nlost);
+  ROW("packets corrupted", ncorrupt);
+  ROW("delivery check failures", violations);
+  printf("%-34s", "goodput (msgs per time unit)");
+  for (i = 0; i < n; i++)
+    printf(" %14.6f", res[i].time > 0 ?
+           res[i].messages_delivered / TICKS_TO_UNITS(res[i].time) : 0.0);
+  printf("\n%-34s", "mean message latency");
+  for (i = 0; i < n; i++)
+    printf(" %14.6f", res[i].latency);
+  printf("\n%-34s", "99th percentile latency");
+  for (i = 0; i < n; i++)
+    printf(" %14.6f", res[i].p99);
+  printf("\n");
+#undef ROW
+}
+
+/* two-sided 95% quantile of Student's t distribution with df degrees of
+   freedom */
+static double tquantile(long long df)
+{
+  static const double t95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+
+  if (df <= 30)
+    return t95[df - 1];
+  return 1.96 + 2.4 / df;         /* within 0.002 of the exact value */
+}
+
+/* mean and 95% confidence interval half width of field over the first n
+   samples */
+#define SAMPLE_MEAN_CI(samples, n, field, mean, half)                   \
+  do {                                                                  \
+    double sum_ = 0.0, sq_ = 0.0;                                       \
+    long long k_;                                                       \
+    for (k_ = 0; k_ < (n); k_++) {                                      \
+      sum_ += (samples)[k_].field;                                      \
+      sq_ += (samples)[k_].field * (samples)[k_].field;                 \
+    }                                                                   \
+    (mean) = sum_ / (n);                                                \
+    sq_ = (sq_ - sum_ * (mean)) / ((n) - 1);                            \
+    (half) = tquantile((n) - 1) * sqrt(sq_ > 0.0 ? sq_ : 0.0) / sqrt((double)(n)); \
+  } while (0)
+
+/* have all the intervals of the first n samples reached the target width? */
+static int converged(const struct sample *samples, long long n)
+{
+  double mean, half;
+
+  if (n < MINREPS)
+    return 0;
+  SAMPLE_MEAN_CI(samples, n, goodput, mean, half);
+  if (half > ciwidth * fabs(mean))
+    return 0;
+  SAMPLE_MEAN_CI(samples, n, resent, mean, half);
+  if (half > ciwidth * fabs(mean))
+    return 0;
+  SAMPLE_MEAN_CI(samples, n, latency, mean, half);
+  return half <= ciwidth * fabs(mean);
+}
+
+/* child side: run replication rep with its own seed, quietly, and send the
+   results back */
+static void runreplication(long long rep, int fd)
+{
+  struct results res;
+  struct sample s;
+
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    _exit(EXIT_FAILURE);
+  seed = SEED + rep;
+  startrun();
+  simulate();
+  endrun(&res);
+  s.rep = rep;
+  s.goodput = res.time > 0 ? res.messages_delivered / TICKS_TO_UNITS(res.time) : 0.0;
+  s.resent = res.packets_resent;
+  s.latency = res.latency;
+  if (write(fd, &s, sizeof(s)) != sizeof(s))
+    _exit(EXIT_FAILURE);
+  _exit(EXIT_SUCCESS);
+}
+
+/* rerun the scenario with seeds SEED, SEED+1, ... in up to nworkers child
+   processes until every confidence interval is narrow enough or maxreps
+   runs are done.  Samples are considered in seed order, so the outcome
+   does not depend on which child finishes first. */
+static void replicate(void)
+{
+  struct sample *samples, s;
+  char *have;
+  long long launched = 0, running = 0, n = 0;
+  double mean, half;
+  int fd[2], status, stop = 0;
+  pid_t pid;
+
+  samples = calloc(maxreps, sizeof(struct sample));
+  have = calloc(maxreps, 1);
+  if (samples == NULL || have == NULL || pipe(fd) != 0) {
+    printf("cannot set up replications.");
+    exit(EXIT_FAILURE);
+  }
+  printf("\n-----  Replicating %s: up to %lld runs, %d at a time -------- \n\n",
+         proto->name, maxreps, nworkers);
+  while (1) {
+    while (!stop && running < nworkers && launched < maxreps) {
+      fflush(stdout);
+      pid = fork();
+      if (pid < 0) {
+        printf("cannot start replication: fork failed\n");
+        exit(EXIT_FAILURE);
+      }
+      if (pid == 0) {
+        close(fd[0]);
+        runreplication(launched, fd[1]);
+      }
+      launched++;
+      running++;
     }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
+    if (running == 0)
+      break;
+
+    /* a child that exited cleanly has already written its sample */
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+        read(fd[0], &s, sizeof(s)) != sizeof(s)) {
+      printf("replication failed\n");
+      exit(EXIT_FAILURE);
     }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
+    running--;
+    samples[s.rep] = s;
+    have[s.rep] = 1;
+    while (!stop && n < launched && have[n]) {
+      printf("run %4lld (seed %lld): goodput %f, resends %.0f, latency %f\n",
+             n + 1, (long long)SEED + n, samples[n].goodput, samples[n].resent,
+             samples[n].latency);
+      n++;
+      stop = converged(samples, n) || n == maxreps;
     }
-    free(eventptr);
   }
+  close(fd[0]);
+  close(fd[1]);
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  printf("\n%lld replications, %s\n", n,
+         converged(samples, n) ? "all 95% confidence intervals within target" :
+         "replication limit reached before the target width");
+  if (n >= 2) {
+    SAMPLE_MEAN_CI(samples, n, goodput, mean, half);
+    printf("goodput (msgs per time unit):  %f +/- %f\n", mean, half);
+    SAMPLE_MEAN_CI(samples, n, resent, mean, half);
+    printf("packet resends by A:  %f +/- %f\n", mean, half);
+    SAMPLE_MEAN_CI(samples, n, latency, mean, half);
+    printf("mean message latency:  %f +/- %f\n", mean, half);
+  }
+  free(samples);
+  free(have);
+}
+
+/* run the scenario for every FEC group size and loss probability asked
+   for, then print goodput and latency as a table */
+static void fecsweep(void)
+{
+  struct results res;
+  double goodput[MAXSWEEP][MAXSWEEP], latency[MAXSWEEP][MAXSWEEP];
+  int i, j, n;
+
+  if (nsweeploss == 0)
+    sweeploss[nsweeploss++] = lossprob;
+  for (i = 0; i < nsweeploss; i++)
+    for (j = 0; j < nsweepk; j++) {
+      lossprob = sweeploss[i];
+      fec_group = (int)sweepk[j];
+      printf("\n-----  Running %s with loss %f, FEC k %d -------- \n",
+             proto->name, lossprob, fec_group);
+      startrun();
+      simulate();
+      endrun(&res);
+      goodput[i][j] = res.time > 0 ? res.messages_delivered / TICKS_TO_UNITS(res.time) : 0.0;
+      latency[i][j] = res.latency;
+    }
+
+  printf("\n-----  FEC sweep (%s, k = 0 is no FEC) -------- \n", proto->name);
+  for (i = 0; i < 2; i++) {
+    printf("\n%-18s", i == 0 ? "goodput" : "mean latency");
+    for (j = 0; j < nsweepk; j++)
+      printf("   k %-8d", (int)sweepk[j]);
+    printf("\n");
+    for (j = 0; j < nsweeploss; j++) {
+      printf("loss %-13.4f", sweeploss[j]);
+      for (n = 0; n < nsweepk; n++)
+        printf(" %12.6f", i == 0 ? goodput[j][n] : latency[j][n]);
+      printf("\n");
+    }
+  }
+}
+
+/* a tuning candidate and how it did in its latest round */
+struct candidate {
+  struct protoparams p;
+  int order;                      /* place in the grid, to break ties */
+  double goodput;
+  double p99;
+};
+
+/* a candidate's result, sent back to the parent through a pipe */
+struct trial {
+  int index;
+  double goodput;
+  double p99;
+};
+
+/* best goodput first, then lowest 99th percentile latency */
+static int bycandidate(const void *a, const void *b)
+{
+  const struct candidate *x = a, *y = b;
+
+  if (x->goodput != y->goodput)
+    return x->goodput > y->goodput ? -1 : 1;
+  if (x->p99 != y->p99)
+    return x->p99 < y->p99 ? -1 : 1;
+  return x->order - y->order;
+}
+
+/* child process: run one candidate on budget messages, with the same seed
+   as every other, and write how it did to fd.  A run still going after
+   TUNE_SLACK times the arrival time of its messages is stopped there */
+static void runtrial(const struct candidate *c, int index, long long budget, int fd)
+{
+  struct results res;
+  struct trial t;
+  simtime_t limit = UNITS_TO_TICKS(TUNE_SLACK * budget * lambda);
+
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    _exit(EXIT_FAILURE);
+  params = c->p;
+  nsimmax = budget;
+  startrun();
+  rununtil(limit);
+  if (evlist != NULL)
+    now = limit;
+  endrun(&res);
+  t.index = index;
+  t.goodput = res.time > 0 ? res.messages_delivered / TICKS_TO_UNITS(res.time) : 0.0;
+  t.p99 = res.p99;
+  if (write(fd, &t, sizeof(t)) != sizeof(t))
+    _exit(EXIT_FAILURE);
+  _exit(EXIT_SUCCESS);
+}
+
+/* search window x sequence space x timeout for the best goodput by
+   successive halving: every candidate gets a short run, the better half
+   goes on to runs twice as long, and so on until one is left, which has
+   then been run on the whole scenario.  Runs of a round are spread over
+   nworkers child processes */
+static void autotune(void)
+{
+  static const int windows[] = { 1, 2, 4, 6, 8, 12, 16, 24, 32, 48, 64 };
+  static const double rtts[] = { 8, 12, 16, 24, 32, 48, 64 };
+  struct candidate *cand, c;
+  struct trial t;
+  long long budget, lastbudget = 0;
+  int fd[2], status, m = 0, rounds = 0, r, i, j, k, launched, running;
+  pid_t pid;
+
+  cand = malloc(sizeof(windows) / sizeof(windows[0]) * 3 * sizeof(rtts) / sizeof(rtts[0]) *
+                sizeof(struct candidate));
+  if (cand == NULL || pipe(fd) != 0) {
+    printf("cannot set up tuning.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < (int)(sizeof(windows) / sizeof(windows[0])); i++)
+    for (j = 0; j < 3; j++)
+      for (k = 0; k < (int)(sizeof(rtts) / sizeof(rtts[0])); k++) {
+        c.p.window = windows[i];
+        c.p.seqspace = j == 0 ? windows[i] + 1 : windows[i] << j;  /* w+1, 2w, 4w */
+        c.p.rtt = rtts[k];
+        if (!proto->params_ok(&c.p) || (j == 1 && c.p.seqspace == windows[i] + 1))
+          continue;
+        c.order = m;
+        cand[m++] = c;
+      }
+  for (i = m; i > 1; i = (i + 1) / 2)
+    rounds++;
+  if (rounds == 0)
+    rounds = 1;
+
+  printf("\n-----  Tuning %s: %d candidates, %d rounds, %d at a time -------- \n\n",
+         proto->name, m, rounds, nworkers);
+  for (r = 0; r < rounds; r++) {
+    budget = nsimmax >> (rounds - 1 - r);
+    if (budget < TUNE_MINMSGS)
+      budget = TUNE_MINMSGS;
+    if (budget > nsimmax)
+      budget = nsimmax;
+    /* the same runs again would only give the same results */
+    launched = running = 0;
+    if (budget == lastbudget)
+      launched = m;
+    lastbudget = budget;
+    while (launched < m || running > 0) {
+      while (running < nworkers && launched < m) {
+        fflush(stdout);
+        pid = fork();
+        if (pid < 0) {
+          printf("cannot start tuning run: fork failed\n");
+          exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+          close(fd[0]);
+          runtrial(&cand[launched], launched, budget, fd[1]);
+        }
+        launched++;
+        running++;
+      }
+      if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+          read(fd[0], &t, sizeof(t)) != sizeof(t)) {
+        printf("tuning run failed\n");
+        exit(EXIT_FAILURE);
+      }
+      running--;
+      cand[t.index].goodput = t.goodput;
+      cand[t.index].p99 = t.p99;
+    }
+    qsort(cand, m, sizeof(struct candidate), bycandidate);
+    printf("round %d: %3d candidates, %lld messages each; best window %d, sequence space %d, "
+           "timeout %g: goodput %f\n", r + 1, m, budget, cand[0].p.window, cand[0].p.seqspace,
+           cand[0].p.rtt, cand[0].goodput);
+    m = (m + 1) / 2;
+  }
+  close(fd[0]);
+  close(fd[1]);
+
+  printf("\n-----  Best configuration for %s -------- \n", proto->name);
+  printf("window %d, sequence space %d, timeout %g (-X %d,%d,%g)\n",
+         cand[0].p.window, cand[0].p.seqspace, cand[0].p.rtt,
+         cand[0].p.window, cand[0].p.seqspace, cand[0].p.rtt);
+  printf("goodput (msgs per time unit):  %f\n", cand[0].goodput);
+  printf("99th percentile latency:  %f\n", cand[0].p99);
+  free(cand);
+}
+
+int main(int argc, char *argv[])
+{
+  struct results res[sizeof(protocols) / sizeof(protocols[0])];
+  int n;
+
+  parseargs(argc, argv);
+  if (restorefile != NULL) {
+    link_init(&links[A], 0.0, 0, AQM_DROPTAIL, 0);
+    link_init(&links[B], 0.0, 0, AQM_DROPTAIL, 0);
+    restoresnapshot();
+    simulate();
+    endrun(&res[0]);
+  }
+  else if (maxreps > 0) {
+    init();
+    replicate();
+  }
+  else if (nsweepk > 0) {
+    init();
+    fecsweep();
+  }
+  else if (tune) {
+    init();
+    autotune();
+  }
+  else if (compare) {
+    init();
+    for (n = 0; protocols[n] != NULL; n++) {
+      proto = protocols[n];
+      printf("\n-----  Running protocol %s -------- \n", proto->name);
+      startrun();
+      simulate();
+      endrun(&res[n]);
+    }
+    comparison(res, n);
+  }
+  else {
+    init();
+    startrun();
+    simulate();
+    endrun(&res[0]);
+  }
+  chanlog_close();
+  sink_close();
+  workload_close();
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
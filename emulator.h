@@ -1,19 +1,24 @@
 extern int TRACE;
 
 /* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+extern long long total_ACKs_received;
+extern long long packets_resent;       /* count of the number of packets resent  */
+extern long long new_ACKs;      /* count of the number of acks correctly received */
+extern long long packets_received;  /* count of the packets received by receiver */
+extern long long window_full; /* count of the number of messages dropped due to full window */
 
 #define   A    0
 #define   B    1
 
+/* messages are tagged with one of these many independent streams */
+#define MAXSTREAMS 16
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
 struct msg {
+  int stream;           /* 0 .. MAXSTREAMS-1, ordered independently */
+  int length;           /* bytes of data in use, 20 unless compressed */
   char data[20];
 };
 
@@ -24,17 +29,37 @@ struct pkt {
   int seqnum;
   int acknum;
   int checksum;
+  int stream;           /* stream of the message carried */
+  int ssn;              /* its sequence number within the stream */
+  int length;           /* bytes of payload in use */
   char payload[20];
 };
 
+/* bytes of a packet ahead of its payload, as charged on the link */
+#define PKT_HEADER ((int)(sizeof(struct pkt) - 20))
+
 /* send to A or B (int), packet to send */
 extern void tolayer3(int, struct pkt);  
 
 /* deliver to A or B (int), data to deliver */
 extern void tolayer5(int, char[20]); 
 
+/* the same for a message of the given stream, in order within it, */
+/* and length bytes of payload, perhaps compressed */
+extern void tolayer5_stream(int, int, char[20], int);
+
+/* simulated time is kept as a 64-bit count of ticks */
+typedef long long simtime_t;
+#define TICKS_PER_UNIT 1000000LL
+#define UNITS_TO_TICKS(x) ((simtime_t)((x) * TICKS_PER_UNIT + 0.5))
+#define TICKS_TO_UNITS(t) ((double)(t) / TICKS_PER_UNIT)
+#define SIMTIME_MAX 0x7fffffffffffffffLL   /* "never" */
+
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
+/* start timer at A or B (int), increment in ticks */
+extern void starttimer_ticks(int, simtime_t);
+
 /* stop timer at A or B (int) */
 extern void stoptimer(int);               
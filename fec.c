@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "fec.h"
+#include "checkpoint.h"
+
+int fec_group = 0;
+
+/* running XOR of a group of packets */
+struct xorsum {
+  int seqnum;
+  int checksum;
+  int stream;
+  int ssn;
+  int length;
+  char payload[20];
+  int count;                 /* packets in the sum */
+  int longest;               /* longest payload in the sum */
+};
+
+struct fecstate {
+  /* sender */
+  struct xorsum out;
+  long long group;           /* group being sent */
+  long long parities;        /* parity packets sent */
+  /* receiver */
+  struct xorsum in;          /* intact data packets since the last parity */
+  int inseq[FEC_MAXGROUP];   /* ... and their seqnums */
+  long long lastparity;      /* group of the last parity seen, -1 = none */
+  long long rebuilt;         /* packets recovered */
+  long long unrecoverable;   /* groups with more than one packet missing */
+  long long mismatches;      /* rebuilt packets failing the checksum */
+  long long stale;           /* rebuilt packets B could take for new data */
+};
+
+static struct fecstate st;
+
+static void add(struct xorsum *x, const struct pkt *p)
+{
+  int i;
+
+  x->seqnum ^= p->seqnum;
+  x->checksum ^= p->checksum;
+  x->stream ^= p->stream;
+  x->ssn ^= p->ssn;
+  x->length ^= p->length;
+  if (p->length > x->longest)
+    x->longest = p->length;
+  for (i = 0; i < 20; i++)
+    x->payload[i] ^= p->payload[i];
+  x->count++;
+}
+
+void fec_reset(void)
+{
+  memset(&st, 0, sizeof(st));
+  st.lastparity = -1;
+}
+
+/* A sent packet; when it completes a group, fill in parity and the
+   bytes of its payload that go on the wire, and return 1 */
+int fec_output(const struct pkt *packet, struct pkt *parity, int *bytes)
+{
+  add(&st.out, packet);
+  if (st.out.count < fec_group)
+    return 0;
+  parity->seqnum = st.out.seqnum;
+  parity->acknum = FEC_PARITY(st.group);
+  parity->checksum = st.out.checksum;
+  parity->stream = st.out.stream;
+  parity->ssn = st.out.ssn;
+  parity->length = st.out.length;
+  *bytes = st.out.longest;
+  memcpy(parity->payload, st.out.payload, 20);
+  memset(&st.out, 0, sizeof(st.out));
+  st.group++;
+  st.parities++;
+  return 1;
+}
+
+/* packet arrived for B; see the FEC_ codes */
+int fec_input(const struct pkt *packet, struct pkt *rebuilt,
+              const struct protocol *proto, void *pstate)
+{
+  long long group;
+  int i, result = FEC_CONSUMED;
+
+  if (packet->acknum > FEC_PARITY(0)) {
+    if (proto->checksum(*packet) == packet->checksum) {
+      if (st.in.count < FEC_MAXGROUP)
+        st.inseq[st.in.count] = packet->seqnum;
+      add(&st.in, packet);
+    }
+    return FEC_PASS;
+  }
+
+  /* parity: the sum only covers its group if the previous parity came */
+  group = -2 - (long long)packet->acknum;
+  if (group == st.lastparity + 1 && st.in.count == fec_group - 1) {
+    rebuilt->seqnum = packet->seqnum ^ st.in.seqnum;
+    rebuilt->acknum = -1;       /* NOTINUSE, as on every data packet */
+    rebuilt->checksum = packet->checksum ^ st.in.checksum;
+    rebuilt->stream = packet->stream ^ st.in.stream;
+    rebuilt->ssn = packet->ssn ^ st.in.ssn;
+    rebuilt->length = packet->length ^ st.in.length;
+    for (i = 0; i < 20; i++)
+      rebuilt->payload[i] = packet->payload[i] ^ st.in.payload[i];
+    if (proto->checksum(*rebuilt) != rebuilt->checksum)
+      st.mismatches++;
+    else {
+      for (i = 0; i < st.in.count; i++)
+        if (proto->aliases(pstate, rebuilt->seqnum, st.inseq[i]))
+          break;
+      if (i < st.in.count)
+        st.stale++;
+      else {
+        st.rebuilt++;
+        result = FEC_REBUILT;
+      }
+    }
+  }
+  else if (group == st.lastparity + 1 && st.in.count < fec_group - 1)
+    st.unrecoverable++;
+  st.lastparity = group;
+  memset(&st.in, 0, sizeof(st.in));
+  return result;
+}
+
+void fec_report(void)
+{
+  printf("fec: k %d, parity packets sent: %lld, packets rebuilt at B: %lld, "
+         "groups with several losses: %lld, rebuilds failing the checksum: %lld, "
+         "rebuilds dropped as stale: %lld\n",
+         fec_group, st.parities, st.rebuilt, st.unrecoverable, st.mismatches, st.stale);
+}
+
+void fec_checkpoint(struct ckpt *c)
+{
+  CKPT_IO(c, st);
+}
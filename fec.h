@@ -0,0 +1,42 @@
+/* ******************************************************************
+   XOR forward error correction between the protocol and the channel.
+   After every k packets A hands to tolayer3, one parity packet follows
+   whose payload and header fields are the XOR of those k packets',
+   except for the acknum: FEC_PARITY(group), always below -1, marks it
+   as parity.  Data packets carry acknum NOTINUSE (-1), so the two never
+   mix up.  At B the shim passes data packets straight through and keeps
+   a running XOR of the intact ones since the last parity; when parity
+   for the next group arrives and exactly one of its k packets is
+   missing, the missing one is rebuilt and, if the protocol's checksum
+   agrees, handed to B before any retransmission could arrive.  Payload
+   bytes past a packet's length are zero, so the parity only needs to
+   send as many as the longest packet of its group has; its length
+   field carries the XOR of the lengths to rebuild the missing one's.
+
+   A rebuilt packet reaches B up to k-1 packets late.  If it was a
+   resend B already had and B has since accepted a packet that moves
+   its window round to the same seqnum again, B would take it for new
+   data, so the rebuild is dropped when the protocol says one of the
+   intact packets of the group aliases it.  This relies on the channel
+   keeping each direction in order, as all the backends do.
+**********************************************************************/
+
+#define FEC_PARITY(group) (-2 - (int)(group))
+#define FEC_MAXGROUP 64
+
+/* what fec_input did with a packet for B */
+#define FEC_PASS     0   /* ordinary packet, give it to B */
+#define FEC_CONSUMED 1   /* parity, nothing for B */
+#define FEC_REBUILT  2   /* parity that rebuilt a lost packet, give that to B */
+
+extern int fec_group;    /* k, 0 = off */
+
+extern void fec_reset(void);
+extern int fec_output(const struct pkt *packet, struct pkt *parity, int *bytes);
+struct protocol;
+extern int fec_input(const struct pkt *packet, struct pkt *rebuilt,
+                     const struct protocol *proto, void *pstate);
+extern void fec_report(void);
+
+struct ckpt;
+extern void fec_checkpoint(struct ckpt *c);
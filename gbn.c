@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "emulator.h"
+#include "protocol.h"
 #include "gbn.h"
+#include "checkpoint.h"
+#include "profile.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,6 +23,14 @@
    - removed bidirectional GBN code and other code not used by prac.
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - state kept in a per-instance struct and the entity routines exported
+   through gbn_protocol, so SR and GBN can share one emulator binary
+   - the message's stream travels with it; delivering everything in order
+   also keeps each stream in order
+   - window, sequence space and timeout are set per instance (struct
+   protoparams); the values below are the defaults
+   - packets carry the length of their payload, which may be compressed;
+   ACKs carry none
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
@@ -28,25 +39,44 @@
 #define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+struct gbn {
+  int window, seqspace;           /* see struct protoparams */
+  double rtt;
+
+  /* sender (A) */
+  struct pkt buffer[MAXWINDOW];   /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+
+  /* receiver (B) */
+  int expectedseqnum;  /* the sequence number expected next by the receiver */
+  int B_nextseqnum;    /* the sequence number for the next packets sent by B */
+};
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct pkt packet)
 {
   int checksum = 0;
   int i;
+  PROF_FUNC("gbn ComputeChecksum");
 
   checksum = packet.seqnum;
   checksum += packet.acknum;
+  checksum += packet.stream;
+  checksum += packet.ssn;
+  checksum += packet.length;
   for ( i=0; i<20; i++ )
     checksum += (int)(packet.payload[i]);
 
   return checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(struct pkt packet)
 {
   if (packet.checksum == ComputeChecksum(packet))
     return (false);
@@ -57,34 +87,33 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output(void *self, struct msg message)
 {
+  struct gbn *g = self;
   struct pkt sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  if ( g->windowcount < g->window) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = g->A_nextseqnum;
     sendpkt.acknum = NOTINUSE;
+    sendpkt.stream = message.stream;
+    sendpkt.ssn = NOTINUSE;
+    sendpkt.length = message.length;
     for ( i=0; i<20 ; i++ )
       sendpkt.payload[i] = message.data[i];
     sendpkt.checksum = ComputeChecksum(sendpkt);
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+    g->windowlast = (g->windowlast + 1) % g->window;
+    g->buffer[g->windowlast] = sendpkt;
+    g->windowcount++;
 
     /* send out packet */
     if (TRACE > 0)
@@ -92,11 +121,11 @@ void A_output(struct msg message)
     tolayer3 (A, sendpkt);
 
     /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+    if (g->windowcount == 1)
+      starttimer(A,g->rtt);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    g->A_nextseqnum = (g->A_nextseqnum + 1) % g->seqspace;
   }
   /* if blocked,  window is full */
   else {
@@ -110,8 +139,9 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input(void *self, struct pkt packet)
 {
+  struct gbn *g = self;
   int ackcount = 0;
   int i;
 
@@ -122,9 +152,9 @@ void A_input(struct pkt packet)
     total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+    if (g->windowcount != 0) {
+          int seqfirst = g->buffer[g->windowfirst].seqnum;
+          int seqlast = g->buffer[g->windowlast].seqnum;
           /* check case when seqnum has and hasn't wrapped */
           if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
               ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
@@ -138,19 +168,19 @@ void A_input(struct pkt packet)
             if (packet.acknum >= seqfirst)
               ackcount = packet.acknum + 1 - seqfirst;
             else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
+              ackcount = g->seqspace - seqfirst + packet.acknum;
 
 	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            g->windowfirst = (g->windowfirst + ackcount) % g->window;
 
             /* delete the acked packets from window buffer */
             for (i=0; i<ackcount; i++)
-              windowcount--;
+              g->windowcount--;
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
+            if (g->windowcount > 0)
+              starttimer(A, g->rtt);
 
           }
         }
@@ -164,84 +194,113 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void *self)
 {
+  struct gbn *g = self;
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  for(i=0; i<g->windowcount; i++) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", (g->buffer[(g->windowfirst+i) % g->window]).seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
+    tolayer3(A,g->buffer[(g->windowfirst+i) % g->window]);
     packets_resent++;
-    if (i==0) starttimer(A,RTT);
+    if (i==0) starttimer(A,g->rtt);
   }
 }
 
+/* number of packets sent but not yet acknowledged, for progress reports */
+static int A_occupancy(void *self)
+{
+  struct gbn *g = self;
+
+  return g->windowcount;
+}
+
+/* size of the send window, for sources that keep it full */
+static int A_window(void *self)
+{
+  struct gbn *g = self;
+
+  return g->window;
+}
+
+/* B expects seqnum again right after accepting the packet before it */
+static int aliases(void *self, int seqnum, int later)
+{
+  struct gbn *g = self;
 
+  return later == (seqnum + g->seqspace - 1) % g->seqspace;
+}
+
+/* GBN's receiver never buffers: out of order packets are discarded */
+static int B_occupancy(void *self)
+{
+  return 0;
+}
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(struct gbn *g)
 {
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
+  g->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  g->windowfirst = 0;
+  g->windowlast = -1;   /* windowlast is where the last packet sent is stored.
 		     new packets are placed in winlast + 1
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+  g->windowcount = 0;
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-
-
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void B_input(void *self, struct pkt packet)
 {
+  struct gbn *g = self;
   struct pkt sendpkt;
   int i;
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  if  ( (!IsCorrupted(packet))  && (packet.seqnum == g->expectedseqnum) ) {
     if (TRACE > 0)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
     packets_received++;
 
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
+    tolayer5_stream(B, packet.stream, packet.payload, packet.length);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt.acknum = g->expectedseqnum;
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    g->expectedseqnum = (g->expectedseqnum + 1) % g->seqspace;
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0)
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
+    if (g->expectedseqnum == 0)
+      sendpkt.acknum = g->seqspace - 1;
     else
-      sendpkt.acknum = expectedseqnum - 1;
+      sendpkt.acknum = g->expectedseqnum - 1;
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt.seqnum = g->B_nextseqnum;
+  sendpkt.stream = NOTINUSE;
+  sendpkt.ssn = NOTINUSE;
+  sendpkt.length = 0;
+  g->B_nextseqnum = (g->B_nextseqnum + 1) % 2;
 
-  /* we don't have any data to send.  fill payload with 0's */
+  /* we don't have any data to send.  fill payload with 0's, none of it sent */
   for ( i=0; i<20 ; i++ )
     sendpkt.payload[i] = '0';
 
@@ -254,10 +313,19 @@ void B_input(struct pkt packet)
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(struct gbn *g)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  g->expectedseqnum = 0;
+  g->B_nextseqnum = 1;
+}
+
+/* save or restore the sender and receiver state in a snapshot */
+static void checkpoint(void *self, struct ckpt *c)
+{
+  struct gbn *g = self;
+
+  ckpt_tag(c, "GBN");
+  CKPT_IO(c, *g);
 }
 
 /******************************************************************************
@@ -265,11 +333,60 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(void *self, struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void *self)
 {
 }
+
+/* the receiver must tell a new window from the one before it */
+static int params_ok(const struct protoparams *p)
+{
+  return p->window >= 1 && p->window <= MAXWINDOW && p->seqspace >= p->window + 1 &&
+         p->seqspace <= MAXSEQSPACE && p->rtt > 0.0;
+}
+
+/* create an instance with both entities initialised */
+static void *create(const struct protoparams *p)
+{
+  struct gbn *g = calloc(1, sizeof(struct gbn));
+
+  if (g == NULL) {
+    printf("memory allocation for protocol failed.");
+    exit(EXIT_FAILURE);
+  }
+  g->window = p->window;
+  g->seqspace = p->seqspace;
+  g->rtt = p->rtt;
+  A_init(g);
+  B_init(g);
+  return g;
+}
+
+static void destroy(void *self)
+{
+  free(self);
+}
+
+const struct protocol gbn_protocol = {
+  "gbn",
+  { WINDOWSIZE, SEQSPACE, RTT },
+  params_ok,
+  create,
+  destroy,
+  A_output,
+  A_input,
+  A_timerinterrupt,
+  B_output,
+  B_input,
+  B_timerinterrupt,
+  A_occupancy,
+  A_window,
+  B_occupancy,
+  ComputeChecksum,
+  aliases,
+  checkpoint
+};
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "link.h"
+#include "checkpoint.h"
+
+/* ******************************************************************
+   Bottleneck link model: serialization rate, finite FIFO and AQM.
+
+   The FIFO is never serviced by events of its own.  Since the link is
+   first-in first-out with a fixed rate, the departure time of a packet
+   is known the moment it is enqueued, so the queue is just a ring of
+   departure times which is drained lazily whenever the link is used.
+   CoDel normally decides at dequeue; here it is evaluated at enqueue
+   using the packet's (already known) dequeue time and sojourn.
+**********************************************************************/
+
+#define RED_WQ      0.002   /* weight of the queue length EWMA */
+#define RED_MAXP    0.1     /* drop probability at max threshold */
+#define RED_MINTH   5       /* thresholds used when the queue is unlimited */
+#define RED_MAXTH   15
+
+#define CODEL_TARGET   UNITS_TO_TICKS(1.0)   /* acceptable standing queue delay */
+#define CODEL_INTERVAL UNITS_TO_TICKS(16.0)  /* one RTT of the emulated path */
+
+#define LINK_SEED 0x853c49e6748fea9bULL
+
+void link_init(struct link *l, double rate, int qlimit, int aqm, unsigned long long seed)
+{
+  memset(l, 0, sizeof(*l));
+  l->rng = LINK_SEED ^ seed;
+  l->rate = rate;
+  l->qlimit = qlimit;
+  l->aqm = aqm;
+  l->qcap = (qlimit > 0) ? qlimit : 64;
+  if (rate > 0.0) {
+    l->departs = malloc(l->qcap * sizeof(simtime_t));
+    if (l->departs == NULL) {
+      printf("memory allocation for link failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void link_free(struct link *l)
+{
+  free(l->departs);
+  l->departs = NULL;
+}
+
+int link_aqm_byname(const char *name)
+{
+  if (strcmp(name, "droptail") == 0)
+    return AQM_DROPTAIL;
+  if (strcmp(name, "red") == 0)
+    return AQM_RED;
+  if (strcmp(name, "codel") == 0)
+    return AQM_CODEL;
+  return -1;
+}
+
+/* remove packets that have left the link by time now, integrating occupancy */
+static void drain(struct link *l, simtime_t now)
+{
+  simtime_t dep;
+
+  while (l->qlen > 0 && (dep = l->departs[l->qhead]) <= now) {
+    l->qarea += (double)l->qlen * (dep - l->lastchange);
+    l->lastchange = dep;
+    l->qhead = (l->qhead + 1) % l->qcap;
+    l->qlen--;
+  }
+  l->qarea += (double)l->qlen * (now - l->lastchange);
+  l->lastchange = now;
+}
+
+static void push(struct link *l, simtime_t dep)
+{
+  simtime_t *bigger;
+  int i;
+
+  if (l->qlen == l->qcap) {   /* only happens with an unlimited queue */
+    bigger = malloc(2 * l->qcap * sizeof(simtime_t));
+    if (bigger == NULL) {
+      printf("memory allocation for link failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < l->qlen; i++)
+      bigger[i] = l->departs[(l->qhead + i) % l->qcap];
+    free(l->departs);
+    l->departs = bigger;
+    l->qhead = 0;
+    l->qcap *= 2;
+  }
+  l->departs[(l->qhead + l->qlen) % l->qcap] = dep;
+  l->qlen++;
+  if (l->qlen > l->maxq)
+    l->maxq = l->qlen;
+}
+
+/* uniform on [0,1), from a splitmix64 generator private to the link, so
+   that neither the arrivals nor the channel's draws depend on the queue */
+static double linkrand(struct link *l)
+{
+  unsigned long long z;
+
+  z = (l->rng += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int red_drop(struct link *l)
+{
+  double minth = RED_MINTH, maxth = RED_MAXTH;
+
+  if (l->qlimit > 0) {
+    minth = l->qlimit / 4.0;
+    maxth = 3.0 * l->qlimit / 4.0;
+  }
+  l->avg = (1 - RED_WQ) * l->avg + RED_WQ * l->qlen;
+  if (l->avg < minth)
+    return 0;
+  if (l->avg >= maxth)
+    return 1;
+  return linkrand(l) < RED_MAXP * (l->avg - minth) / (maxth - minth);
+}
+
+static simtime_t codel_next(struct link *l, simtime_t t)
+{
+  return t + (simtime_t)(CODEL_INTERVAL / sqrt((double)l->count));
+}
+
+/* run the CoDel state machine at dequeue time t for a packet that waited sojourn */
+static int codel_drop(struct link *l, simtime_t t, simtime_t sojourn)
+{
+  int ok;
+
+  if (sojourn < CODEL_TARGET || l->qlen <= 1) {
+    l->first_above = 0;
+    ok = 0;
+  }
+  else if (l->first_above == 0) {
+    l->first_above = t + CODEL_INTERVAL;
+    ok = 0;
+  }
+  else
+    ok = (t >= l->first_above);
+
+  if (l->dropping) {
+    if (!ok)
+      l->dropping = 0;
+    else if (t >= l->drop_next) {
+      l->count++;
+      l->drop_next = codel_next(l, l->drop_next);
+      return 1;
+    }
+  }
+  else if (ok) {
+    l->dropping = 1;
+    if (l->count > 2 && t - l->drop_next < 16 * CODEL_INTERVAL)
+      l->count -= 2;
+    else
+      l->count = 1;
+    l->drop_next = codel_next(l, t);
+    return 1;
+  }
+  return 0;
+}
+
+/* offer a packet of the given size to the link at time now.  On LINK_SENT
+   *depart is set to the time its last bit leaves the transmitter. */
+int link_send(struct link *l, simtime_t now, int bytes, simtime_t *depart)
+{
+  simtime_t start;
+
+  l->offered++;
+  drain(l, now);
+
+  if (l->qlimit > 0 && l->qlen >= l->qlimit) {
+    l->taildrops++;
+    return LINK_TAILDROP;
+  }
+  if (l->aqm == AQM_RED && red_drop(l)) {
+    l->aqmdrops++;
+    return LINK_AQMDROP;
+  }
+
+  start = (l->busy > now) ? l->busy : now;
+  if (l->aqm == AQM_CODEL && codel_drop(l, start, start - now)) {
+    l->aqmdrops++;
+    return LINK_AQMDROP;
+  }
+
+  l->busy = start + UNITS_TO_TICKS(bytes / l->rate);
+  l->qdelay += start - now;
+  push(l, l->busy);
+  *depart = l->busy;
+  return LINK_SENT;
+}
+
+void link_report(struct link *l, const char *name, simtime_t now)
+{
+  long long sent;
+
+  drain(l, now);
+  sent = l->offered - l->taildrops - l->aqmdrops;
+  printf("link %s: packets offered: %lld, tail drops: %lld, AQM drops: %lld\n",
+         name, l->offered, l->taildrops, l->aqmdrops);
+  printf("link %s: max queue: %d, mean queue: %f, mean queueing delay: %f\n",
+         name, l->maxq, now > 0 ? l->qarea / now : 0.0,
+         sent > 0 ? TICKS_TO_UNITS(l->qdelay) / sent : 0.0);
+}
+
+/* save or restore the link, including the departure times still queued */
+void link_checkpoint(struct ckpt *c, struct link *l)
+{
+  simtime_t dep;
+  int i;
+
+  if (CKPT_SAVING(c)) {
+    CKPT_IO(c, *l);
+    for (i = 0; i < l->qlen; i++) {
+      dep = l->departs[(l->qhead + i) % l->qcap];
+      CKPT_IO(c, dep);
+    }
+  }
+  else {
+    link_free(l);
+    CKPT_IO(c, *l);
+    l->departs = NULL;
+    if (l->rate > 0.0) {
+      l->departs = malloc(l->qcap * sizeof(simtime_t));
+      if (l->departs == NULL) {
+        printf("memory allocation for link failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (i = 0; i < l->qlen; i++)
+      CKPT_IO(c, l->departs[i]);
+    l->qhead = 0;
+  }
+}
@@ -0,0 +1,62 @@
+/* ******************************************************************
+   Bottleneck link model used by the emulator.
+
+   Each direction of the channel can be given a serialization rate and a
+   bounded FIFO.  A packet handed to tolayer3 waits in the FIFO until the
+   transmitter is free, is clocked out at the link rate and then
+   propagates to the other side.  When the FIFO is full the packet is
+   dropped (drop-tail), and RED or CoDel can be enabled to drop earlier.
+
+   A rate of 0 means infinite capacity, in which case the emulator keeps
+   its original channel model and never consults the link.
+**********************************************************************/
+
+/* active queue management schemes */
+#define AQM_DROPTAIL 0
+#define AQM_RED      1
+#define AQM_CODEL    2
+
+/* outcome of offering a packet to the link */
+#define LINK_SENT     0
+#define LINK_TAILDROP 1
+#define LINK_AQMDROP  2
+
+struct link {
+  /* configuration */
+  double rate;             /* bytes per time unit, 0 = infinite capacity */
+  int qlimit;              /* max packets queued (including the one being sent), 0 = unlimited */
+  int aqm;                 /* AQM_DROPTAIL, AQM_RED or AQM_CODEL */
+
+  /* queue state, times in ticks */
+  simtime_t busy;          /* time at which the transmitter becomes free */
+  simtime_t *departs;      /* ring of departure times of the packets in the FIFO */
+  int qhead, qlen, qcap;
+  simtime_t lastchange;    /* last time qlen changed, for the occupancy integral */
+
+  /* RED state */
+  double avg;              /* EWMA of the queue length */
+  unsigned long long rng;  /* state of the link's own random stream */
+
+  /* CoDel state */
+  simtime_t first_above;   /* time sojourn went above target, 0 if below */
+  simtime_t drop_next;     /* next scheduled drop while in dropping state */
+  int dropping;
+  int count;
+
+  /* statistics */
+  long long offered;       /* packets offered to the link */
+  long long taildrops;     /* packets dropped because the FIFO was full */
+  long long aqmdrops;      /* packets dropped by RED/CoDel */
+  int maxq;                /* largest FIFO occupancy seen */
+  double qarea;            /* integral of occupancy over time, in packet-ticks */
+  simtime_t qdelay;        /* total queueing delay of sent packets */
+};
+
+extern void link_init(struct link *l, double rate, int qlimit, int aqm, unsigned long long seed);
+extern void link_free(struct link *l);
+extern int link_send(struct link *l, simtime_t now, int bytes, simtime_t *depart);
+extern void link_report(struct link *l, const char *name, simtime_t now);
+extern int link_aqm_byname(const char *name);
+
+struct ckpt;
+extern void link_checkpoint(struct ckpt *c, struct link *l);
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "profile.h"
+
+#ifdef PROFILE
+
+static struct profslot *slots;   /* every slot entered at least once */
+
+static int bycycles(const void *x, const void *y)
+{
+  const struct profslot *a = *(struct profslot * const *)x;
+  const struct profslot *b = *(struct profslot * const *)y;
+
+  return a->cycles < b->cycles ? 1 : a->cycles > b->cycles ? -1 : 0;
+}
+
+static void prof_report(void)
+{
+  struct profslot *s, **table;
+  int i, n = 0;
+
+  for (s = slots; s != NULL; s = s->next)
+    n++;
+  table = malloc(n * sizeof(*table));
+  if (table == NULL)
+    return;
+  for (i = 0, s = slots; s != NULL; s = s->next)
+    table[i++] = s;
+  qsort(table, n, sizeof(*table), bycycles);
+
+  printf("\n-----  Profile (inclusive %s) -------- \n\n", PROF_UNIT);
+  printf("%-28s %14s %20s %14s\n", "function", "calls", "total", "per call");
+  for (i = 0; i < n; i++)
+    printf("%-28s %14llu %20llu %14.1f\n", table[i]->name, table[i]->calls,
+           table[i]->cycles,
+           table[i]->calls > 0 ? (double)table[i]->cycles / table[i]->calls : 0.0);
+  free(table);
+}
+
+void prof_register(struct profslot *slot)
+{
+  if (slots == NULL)
+    atexit(prof_report);
+  slot->registered = 1;
+  slot->next = slots;
+  slots = slot;
+}
+
+#endif
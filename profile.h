@@ -0,0 +1,89 @@
+/* ******************************************************************
+   Cycle accounting.  Built with -DPROFILE, every function marked with
+   PROF_FUNC and every call wrapped in PROF_CALL counts its calls and the
+   cycles spent in it (inclusive of what it calls), and a table sorted
+   by total cycles is printed at exit.  Without PROFILE the macros
+   compile to nothing.
+
+   Cycles come from rdtsc on x86 and from the monotonic clock, in
+   nanoseconds, elsewhere.  A measurement costs a few tens of cycles, so
+   the figures for the smallest functions are dominated by that.
+**********************************************************************/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_UNIT "cycles"
+
+static inline unsigned long long prof_cycles(void)
+{
+  return __rdtsc();
+}
+#else
+#include <time.h>
+#define PROF_UNIT "ns"
+
+static inline unsigned long long prof_cycles(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#ifdef PROFILE
+
+struct profslot {
+  const char *name;
+  unsigned long long calls;
+  unsigned long long cycles;
+  struct profslot *next;       /* registered slots, NULL terminated */
+  int registered;
+};
+
+struct profscope {
+  struct profslot *slot;
+  unsigned long long start;
+};
+
+extern void prof_register(struct profslot *slot);
+
+static inline struct profscope prof_enter(struct profslot *slot)
+{
+  struct profscope scope;
+
+  if (!slot->registered)
+    prof_register(slot);
+  scope.slot = slot;
+  scope.start = prof_cycles();
+  return scope;
+}
+
+static inline void prof_leave(struct profscope *scope)
+{
+  scope->slot->cycles += prof_cycles() - scope->start;
+  scope->slot->calls++;
+}
+
+/* put after a function's declarations: accounts for the rest of it,
+   whichever return it leaves through */
+#define PROF_FUNC(name)                                                 \
+  static struct profslot prof_slot_ = { name, 0, 0, NULL, 0 };          \
+  struct profscope prof_scope_ __attribute__((cleanup(prof_leave))) =   \
+    prof_enter(&prof_slot_)
+
+/* account for one statement */
+#define PROF_CALL(name, stmt)                                           \
+  do {                                                                  \
+    static struct profslot prof_slot_ = { name, 0, 0, NULL, 0 };        \
+    struct profscope prof_scope_ = prof_enter(&prof_slot_);             \
+    stmt;                                                               \
+    prof_leave(&prof_scope_);                                           \
+  } while (0)
+
+#else
+
+#define PROF_FUNC(name)       struct profslot
+#define PROF_CALL(name, stmt) do { stmt; } while (0)
+
+#endif
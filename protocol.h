@@ -0,0 +1,60 @@
+/* ******************************************************************
+   Protocol descriptor.  Each transport protocol (sr.c, gbn.c) exports
+   one of these: its name, a table of the entity routines the emulator
+   calls, and a constructor for the per-instance state those routines
+   work on.  All protocols link into the same binary and the emulator
+   picks one by name at run time.
+**********************************************************************/
+
+/* included for extension to bidirectional communication */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+
+struct ckpt;
+
+/* largest window and sequence space any instance may use */
+#define MAXWINDOW   64
+#define MAXSEQSPACE 128
+
+/* the constants an instance runs with, chosen when it is created */
+struct protoparams {
+  int window;           /* most packets A keeps unacknowledged */
+  int seqspace;         /* sequence numbers run 0 .. seqspace-1 */
+  double rtt;           /* retransmission timeout, time units */
+};
+
+struct protocol {
+  const char *name;
+
+  /* the assignment's values, and whether others are usable */
+  struct protoparams defaults;
+  int (*params_ok)(const struct protoparams *p);
+
+  /* allocate an instance, initialised as A_init()/B_init() would */
+  void *(*create)(const struct protoparams *p);
+  void (*destroy)(void *self);
+
+  void (*A_output)(void *self, struct msg message);
+  void (*A_input)(void *self, struct pkt packet);
+  void (*A_timerinterrupt)(void *self);
+  void (*B_output)(void *self, struct msg message);
+  void (*B_input)(void *self, struct pkt packet);
+  void (*B_timerinterrupt)(void *self);
+
+  /* packets sent by A but not yet acknowledged */
+  int (*A_occupancy)(void *self);
+  /* the most packets A keeps unacknowledged */
+  int (*A_window)(void *self);
+  /* packets B holds waiting for earlier ones */
+  int (*B_occupancy)(void *self);
+  /* the checksum the protocol puts in its packets */
+  int (*checksum)(struct pkt packet);
+  /* nonzero if, once B has accepted packet later, a late copy of packet
+     seqnum could be taken for new data (used to vet FEC rebuilds) */
+  int (*aliases)(void *self, int seqnum, int later);
+
+  /* save or restore the state of both entities in a snapshot */
+  void (*checkpoint)(void *self, struct ckpt *c);
+};
+
+extern const struct protocol *protocols[];   /* NULL terminated */
+extern const struct protocol *protocol_byname(const char *name);
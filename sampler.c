@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "sampler.h"
+
+#define SAMPLER_BUF (1 << 16)   /* stdio buffer of the CSV file */
+
+simtime_t sample_next = SIMTIME_MAX;
+
+static const char *csvname;
+static simtime_t interval;      /* ticks between samples, 0 = off */
+
+/* one array per column */
+static simtime_t *coltime;
+static int *colwindow;
+static int *colinab, *colinba;
+static long long *colresends;
+static int *colrxbuf;
+static long long nsamples, capacity;
+
+static void sampler_fail(const char *what)
+{
+  printf("time series %s: %s\n", csvname, what);
+  exit(EXIT_FAILURE);
+}
+
+static void *grow(void *col, size_t elsize)
+{
+  col = realloc(col, capacity * elsize);
+  if (col == NULL)
+    sampler_fail("out of memory");
+  return col;
+}
+
+static void setcapacity(long long n)
+{
+  capacity = n;
+  coltime = grow(coltime, sizeof(*coltime));
+  colwindow = grow(colwindow, sizeof(*colwindow));
+  colinab = grow(colinab, sizeof(*colinab));
+  colinba = grow(colinba, sizeof(*colinba));
+  colresends = grow(colresends, sizeof(*colresends));
+  colrxbuf = grow(colrxbuf, sizeof(*colrxbuf));
+}
+
+/* sample every interval time units and write the series to name */
+void sampler_open(const char *name, double units)
+{
+  csvname = name;
+  interval = UNITS_TO_TICKS(units);
+  if (interval <= 0)
+    sampler_fail("the interval must be positive");
+}
+
+/* start a new series, sized for a run ending around expected_end */
+void sampler_reset(simtime_t expected_end)
+{
+  long long n;
+
+  if (interval == 0)
+    return;
+  nsamples = 0;
+  sample_next = 0;
+  n = expected_end / interval + expected_end / interval / 4 + 64;
+  if (n > capacity)
+    setcapacity(n);
+}
+
+/* the state s holds from the last sample point up to (not including)
+   time upto: record it at every sample point in between */
+void sampler_record(simtime_t upto, const struct tsample *s)
+{
+  for (; sample_next < upto; sample_next += interval) {
+    if (nsamples == capacity)
+      setcapacity(2 * capacity);
+    coltime[nsamples] = sample_next;
+    colwindow[nsamples] = s->window;
+    colinab[nsamples] = s->inflight[A];
+    colinba[nsamples] = s->inflight[B];
+    colresends[nsamples] = s->resends;
+    colrxbuf[nsamples] = s->rxbuffer;
+    nsamples++;
+  }
+}
+
+void sampler_write(void)
+{
+  FILE *fp;
+  long long i;
+
+  if (interval == 0)
+    return;
+  fp = fopen(csvname, "w");
+  if (fp == NULL)
+    sampler_fail("cannot create file");
+  setvbuf(fp, NULL, _IOFBF, SAMPLER_BUF);
+  fprintf(fp, "time,window,inflight_ab,inflight_ba,resends,rxbuffer\n");
+  for (i = 0; i < nsamples; i++)
+    fprintf(fp, "%f,%d,%d,%d,%lld,%d\n", TICKS_TO_UNITS(coltime[i]), colwindow[i],
+            colinab[i], colinba[i], colresends[i], colrxbuf[i]);
+  if (fclose(fp) != 0)
+    sampler_fail("write failed");
+  sample_next = SIMTIME_MAX;
+}
@@ -0,0 +1,25 @@
+/* ******************************************************************
+   Time series sampler.  At every multiple of a fixed simulated time
+   interval the emulator records the sender's window occupancy, the
+   packets in flight in each direction, the cumulative number of resends
+   and the receiver's buffer fill.  Samples go into column arrays sized
+   for the expected run length and are written out as CSV at the end.
+
+   When sampling is off sample_next is SIMTIME_MAX, so the only cost in
+   the event loop is one comparison per event.
+**********************************************************************/
+
+/* the state recorded at one sample point */
+struct tsample {
+  int window;           /* packets sent by A and not yet acknowledged */
+  int inflight[2];      /* packets on their way, indexed by the sender */
+  long long resends;    /* packets resent by A so far */
+  int rxbuffer;         /* packets buffered at B */
+};
+
+extern simtime_t sample_next;   /* time of the next sample point */
+
+extern void sampler_open(const char *name, double interval);
+extern void sampler_reset(simtime_t expected_end);
+extern void sampler_record(simtime_t upto, const struct tsample *s);
+extern void sampler_write(void);
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "shmchan.h"
+
+int shmchan_active = 0;
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "profile.h"
+
+#define RING_SLOTS 1024         /* power of two */
+#define CACHELINE  64
+#define IDLE_SPINS 64           /* empty polls before yielding the CPU */
+
+extern double jimsrand(void);
+
+struct slot {
+  simtime_t due;                /* when the receiver may take it */
+  struct pkt pkt;
+};
+
+/* head is written only by the consumer and tail only by the producer, on
+   separate cache lines; each side publishes with a release store and
+   reads the other's index with an acquire load */
+struct ring {
+  unsigned long long head;
+  char pad1[CACHELINE - sizeof(unsigned long long)];
+  unsigned long long tail;
+  char pad2[CACHELINE - sizeof(unsigned long long)];
+  struct slot slots[RING_SLOTS];
+};
+
+/* per process figures, in shared memory so A can report both sides */
+struct side {
+  long long sent, received;     /* packets put on / taken off a ring */
+  long long overflows;          /* packets lost because the ring was full */
+  unsigned long long cycles;    /* spent processing events */
+};
+
+struct region {
+  struct ring ring[2];          /* indexed by the sending entity */
+  struct side side[2];
+  struct timespec start;        /* wall clock time of simulated time 0 */
+  int done;                     /* set by A when the run is over */
+  struct shmchan_peerstats peer;
+};
+
+static struct region *shm;
+static double nsperunit;
+static int self;                /* entity this process runs */
+static simtime_t lastdue[2];    /* due time of the last packet each way */
+static unsigned long long cachedhead[2];  /* producer's copy of the consumer index */
+static double walltime;
+
+/* wall clock time since the start of the run, in ticks */
+static simtime_t wallticks(void)
+{
+  struct timespec ts;
+  double ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ns = (ts.tv_sec - shm->start.tv_sec) * 1e9 + (ts.tv_nsec - shm->start.tv_nsec);
+  return (simtime_t)(ns / nsperunit * TICKS_PER_UNIT);
+}
+
+void shmchan_open(double usecperunit)
+{
+  if (usecperunit <= 0.0) {
+    printf("shared memory channel: microseconds per time unit must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+  nsperunit = usecperunit * 1000.0;
+  shmchan_active = 1;
+}
+
+/* packet handed to tolayer3 by AorB at time now, after loss and corruption */
+void shmchan_send(int AorB, const struct pkt *packet, simtime_t now)
+{
+  struct ring *r = &shm->ring[AorB];
+  struct slot *s;
+  simtime_t due;
+
+  if (r->tail - cachedhead[AorB] == RING_SLOTS) {
+    cachedhead[AorB] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (r->tail - cachedhead[AorB] == RING_SLOTS) {
+      shm->side[AorB].overflows++;
+      return;
+    }
+  }
+  due = now + UNITS_TO_TICKS(1 + 9 * jimsrand());
+  if (due < lastdue[AorB])
+    due = lastdue[AorB];        /* the channel does not reorder */
+  lastdue[AorB] = due;
+  s = &r->slots[r->tail & (RING_SLOTS - 1)];
+  s->due = due;
+  s->pkt = *packet;
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+  shm->side[AorB].sent++;
+}
+
+/* process this side's events due by now and any packet whose time has
+   come; the ring slot is released only after the packet has been
+   processed, so an empty ring means its effects are visible */
+static int service(const struct shmchan_hooks *hooks, int peer)
+{
+  struct ring *r = &shm->ring[peer];
+  struct slot *s;
+  unsigned long long c0;
+  simtime_t t = wallticks();
+  int busy = 0;
+
+  while (r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+    s = &r->slots[r->head & (RING_SLOTS - 1)];
+    if (s->due > t)
+      break;
+    c0 = prof_cycles();
+    hooks->deliver(self, &s->pkt, t);
+    hooks->rununtil(t + 1);
+    shm->side[self].cycles += prof_cycles() - c0;
+    shm->side[self].received++;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+    busy = 1;
+  }
+  if (hooks->nextevent() <= t) {
+    c0 = prof_cycles();
+    hooks->rununtil(t + 1);
+    shm->side[self].cycles += prof_cycles() - c0;
+    busy = 1;
+  }
+  return busy;
+}
+
+static int ringempty(int AorB)
+{
+  struct ring *r = &shm->ring[AorB];
+
+  return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) ==
+         __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* fork B's process and run A in this one until A has no events left and
+   both rings are drained */
+void shmchan_run(const struct shmchan_hooks *hooks, struct shmchan_peerstats *peer)
+{
+  pid_t pid;
+  int status, idle = 0;
+
+#ifdef MAP_ANONYMOUS
+  shm = mmap(NULL, sizeof(struct region), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+#else
+  shm = MAP_FAILED;
+#endif
+  if (shm == MAP_FAILED) {
+    printf("shared memory channel: cannot map shared memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(shm, 0, sizeof(struct region));
+  lastdue[A] = lastdue[B] = 0;
+  cachedhead[A] = cachedhead[B] = 0;
+  clock_gettime(CLOCK_MONOTONIC, &shm->start);
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    printf("shared memory channel: fork failed\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    /* B: the pending events (message arrivals, A's timers) are A's */
+    self = B;
+    hooks->clear();
+    while (!__atomic_load_n(&shm->done, __ATOMIC_ACQUIRE) || !ringempty(A)) {
+      if (service(hooks, A))
+        idle = 0;
+      else if (++idle >= IDLE_SPINS)
+        sched_yield();
+    }
+    hooks->collect(&shm->peer);
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+  }
+
+  self = A;
+  while (1) {
+    if (service(hooks, B))
+      idle = 0;
+    else if (hooks->nextevent() == SIMTIME_MAX && ringempty(A) && ringempty(B))
+      break;
+    else if (++idle >= IDLE_SPINS)
+      sched_yield();
+  }
+  walltime = TICKS_TO_UNITS(wallticks()) * nsperunit / 1e9;
+  __atomic_store_n(&shm->done, 1, __ATOMIC_RELEASE);
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    printf("shared memory channel: B's process failed\n");
+    exit(EXIT_FAILURE);
+  }
+  *peer = shm->peer;
+}
+
+void shmchan_report(void)
+{
+  struct side *s;
+  int i;
+
+  printf("shm: wall time %f s, ring overflows A->B %lld, B->A %lld\n",
+         walltime, shm->side[A].overflows, shm->side[B].overflows);
+  for (i = A; i <= B; i++) {
+    s = &shm->side[i];
+    printf("shm: %c sent %lld, received %lld, %.0f %s per packet\n", i == A ? 'A' : 'B',
+           s->sent, s->received,
+           s->sent + s->received > 0 ? (double)s->cycles / (s->sent + s->received) : 0.0,
+           PROF_UNIT);
+  }
+  munmap(shm, sizeof(struct region));
+  shm = NULL;
+}
+
+#else
+
+void shmchan_open(double usecperunit)
+{
+  printf("shared memory channel: not available on this system\n");
+  exit(EXIT_FAILURE);
+}
+
+void shmchan_run(const struct shmchan_hooks *hooks, struct shmchan_peerstats *peer)
+{
+}
+
+void shmchan_send(int AorB, const struct pkt *packet, simtime_t now)
+{
+}
+
+void shmchan_report(void)
+{
+}
+
+#endif
@@ -0,0 +1,35 @@
+/* ******************************************************************
+   Two-process mode.  A and B run in separate processes connected by
+   two single-producer/single-consumer rings in shared memory, one per
+   direction, which replace the channel behind tolayer3.  The sender
+   stamps each packet with its due time (now plus a drawn delay, never
+   earlier than the previous packet's); the receiver takes it off the
+   ring once the monotonic clock reaches that time.  Loss and corruption
+   are still applied in tolayer3.  Each process times the event
+   processing on its side and reports the cost per packet.
+
+   Simulated time units are mapped to usecperunit microseconds of wall
+   clock time, as for the UDP backend.
+**********************************************************************/
+
+/* counters only B's process sees, handed back to A when it exits */
+struct shmchan_peerstats {
+  long long packets_received;
+  long long messages_delivered;
+};
+
+/* what the backend needs from the emulator */
+struct shmchan_hooks {
+  simtime_t (*nextevent)(void);                /* time of the next emulator event */
+  void (*rununtil)(simtime_t horizon);         /* dispatch emulator events before horizon */
+  void (*deliver)(int AorB, struct pkt *packet, simtime_t when);  /* packet reaches A or B */
+  void (*clear)(void);                         /* drop every pending event */
+  void (*collect)(struct shmchan_peerstats *s);    /* B's counters */
+};
+
+extern int shmchan_active;
+
+extern void shmchan_open(double usecperunit);
+extern void shmchan_run(const struct shmchan_hooks *hooks, struct shmchan_peerstats *peer);
+extern void shmchan_send(int AorB, const struct pkt *packet, simtime_t now);
+extern void shmchan_report(void);
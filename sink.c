@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "sink.h"
+#include "checkpoint.h"
+
+#define SINK_BUF   (1 << 20)            /* stdio buffer of the output file */
+#define HASH_MULT  1099511628211ULL     /* multiplier of the rolling hash */
+
+/* what the sink has seen in the current run */
+struct sinkstate {
+  long long delivered;          /* messages delivered to B's layer 5 */
+  long long violations;         /* deliveries that were not the expected message */
+  unsigned long long hash;      /* rolling hash of all delivered bytes */
+  long long undelivered;        /* accepted messages never delivered, at the end */
+  /* the first violation */
+  long long firstat;            /* delivery number, 0 = none yet */
+  simtime_t firsttime;
+};
+
+static struct sinkstate st;
+static const char *outname;
+static FILE *outfp;
+
+static void sink_fail(const char *what)
+{
+  printf("delivery sink %s: %s\n", outname, what);
+  exit(EXIT_FAILURE);
+}
+
+/* stream delivered payloads to name, in delivery order */
+void sink_open(const char *name)
+{
+  outname = name;
+  outfp = fopen(name, "wb");
+  if (outfp == NULL)
+    sink_fail("cannot create file");
+  setvbuf(outfp, NULL, _IOFBF, SINK_BUF);
+}
+
+void sink_close(void)
+{
+  if (outfp != NULL && fclose(outfp) != 0)
+    sink_fail("write failed");
+  outfp = NULL;
+}
+
+void sink_reset(void)
+{
+  memset(&st, 0, sizeof(st));
+}
+
+static void violation(long long msgno, const char data[20], simtime_t now)
+{
+  st.violations++;
+  if (st.firstat != 0)
+    return;
+  st.firstat = st.delivered;
+  st.firsttime = now;
+  printf("Warning: delivery %lld at time %f is not the expected message: ",
+         st.delivered, TICKS_TO_UNITS(now));
+  if (msgno == SINK_NONE)
+    printf("no message was outstanding");
+  else
+    printf("expected message %lld ('%c')", msgno, (char)(97 + msgno % 26));
+  printf(", got \"%.20s\"\n", data);
+}
+
+/* B delivered data; msgno is the message that should have arrived */
+void sink_deliver(long long msgno, const char data[20], simtime_t now)
+{
+  char expect;
+  int i, ok;
+
+  st.delivered++;
+  for (i = 0; i < 20; i++)
+    st.hash = st.hash * HASH_MULT + (unsigned char)data[i];
+  ok = (msgno != SINK_NONE);
+  if (ok) {
+    expect = (char)(97 + msgno % 26);
+    for (i = 0; i < 20; i++)
+      ok &= (data[i] == expect);
+  }
+  if (!ok)
+    violation(msgno, data, now);
+  if (outfp != NULL && fwrite(data, 1, 20, outfp) != 20)
+    sink_fail("write failed");
+}
+
+/* end of run: undelivered accepted messages are still outstanding */
+void sink_finish(long long undelivered)
+{
+  st.undelivered = undelivered;
+}
+
+long long sink_violations(void)
+{
+  return st.violations + st.undelivered;
+}
+
+/* quiet when all is well, so the usual output is unchanged */
+void sink_report(void)
+{
+  if (st.violations > 0)
+    printf("delivery check: %lld deliveries were not the expected message, first at delivery %lld (time %f)\n",
+           st.violations, st.firstat, TICKS_TO_UNITS(st.firsttime));
+  if (st.undelivered > 0)
+    printf("delivery check: %lld accepted messages were never delivered\n", st.undelivered);
+  if (outfp != NULL)
+    printf("delivery sink: %lld messages written to %s, hash %016llx\n",
+           st.delivered, outname, st.hash);
+}
+
+void sink_checkpoint(struct ckpt *c)
+{
+  CKPT_IO(c, st);
+}
@@ -0,0 +1,22 @@
+/* ******************************************************************
+   Delivery sink.  Every message B hands to layer 5 is checked against
+   the message it should be: the oldest message A accepted on its
+   stream that has not been delivered yet, whose payload is 20 copies
+   of 97 + n % 26 for message number n.  The check keeps constant state
+   (counts, a rolling hash of the delivered data and the first
+   violation) so it is always on.  Delivered data can also be streamed
+   to a file.
+**********************************************************************/
+
+#define SINK_NONE (-1LL)   /* message number when nothing was outstanding */
+
+extern void sink_open(const char *name);
+extern void sink_close(void);
+extern void sink_reset(void);
+extern void sink_deliver(long long msgno, const char data[20], simtime_t now);
+extern void sink_finish(long long undelivered);
+extern long long sink_violations(void);
+extern void sink_report(void);
+
+struct ckpt;
+extern void sink_checkpoint(struct ckpt *c);
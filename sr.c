@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "emulator.h"
+#include "protocol.h"
 #include "sr.h"
+#include "checkpoint.h"
+#include "profile.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,33 +23,71 @@
    - removed bidirectional GBN code and other code not used by prac.
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - state kept in a per-instance struct and the entity routines exported
+   through sr_protocol, so SR and GBN can share one emulator binary
+   - receiver re-acknowledges packets it has already delivered, sender
+   ignores ACKs outside its window, and the sequence space is twice the
+   window, as Selective Repeat requires
+   - messages carry a stream and a per-stream sequence number, and the
+   receiver delivers each stream in order as soon as it can instead of
+   holding every stream behind the oldest missing packet
+   - window, sequence space and timeout are set per instance (struct
+   protoparams); the values below are the defaults
+   - packets carry the length of their payload, which may be compressed;
+   ACKs carry none
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 8      /* Selective Repeat sequence space */
+#define SEQSPACE (2*WINDOWSIZE)  /* Selective Repeat sequence space */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define SSNSPACE 65536  /* per-stream sequence numbers wrap here */
+
+struct sr {
+  int window, seqspace;           /* see struct protoparams */
+  double rtt;
+
+  /* sender (A) */
+  struct pkt buffer[MAXSEQSPACE]; /* cache all sent but unacknowledged packets */
+  bool acked[MAXSEQSPACE];        /* track whether each packet has been ACKed */
+  int base;                       /* current window starting point */
+  int A_nextseqnum;               /* next sequence number to be sent */
+  int timer_index;                /* the current timer monitors the packet sequence number */
+  int nextssn[MAXSTREAMS];        /* next sequence number within each stream */
+
+  /* receiver (B) */
+  struct pkt recv_buffer[MAXSEQSPACE]; /* buffer for out-of-order packets */
+  bool received[MAXSEQSPACE];        /* whether a packet is buffered */
+  bool delivered[MAXSEQSPACE];       /* ... and already given to layer 5 */
+  int expectedssn[MAXSTREAMS];       /* next stream sequence number to deliver */
+  int expectedseqnum;                /* the sequence number expected next by the receiver */
+  int B_nextseqnum;                  /* the sequence number for the next packets sent by B */
+};
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct pkt packet)
 {
   int checksum = 0;
   int i;
+  PROF_FUNC("sr ComputeChecksum");
 
   checksum = packet.seqnum;
   checksum += packet.acknum;
+  checksum += packet.stream;
+  checksum += packet.ssn;
+  checksum += packet.length;
   for ( i=0; i<20; i++ )
     checksum += (int)(packet.payload[i]);
 
   return checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(struct pkt packet)
 {
   if (packet.checksum == ComputeChecksum(packet))
     return (false);
@@ -57,35 +98,34 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[SEQSPACE];  /* cache all sent but unacknowledged packets */
-static bool acked[SEQSPACE];         /* track whether each packet has been ACKed */
-static int base = 0;                 /* current window starting point */
-static int A_nextseqnum = 0;         /* next sequence number to be sent */
-static int timer_index = -1;         /* the current timer monitors the packet sequence number */
-
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output(void *self, struct msg message)
 {
+  struct sr *s = self;
   struct pkt sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if ( (A_nextseqnum + SEQSPACE - base) % SEQSPACE < WINDOWSIZE) {
- 
+  if ( (s->A_nextseqnum + s->seqspace - s->base) % s->seqspace < s->window) {
+
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = s->A_nextseqnum;
     sendpkt.acknum = NOTINUSE;
+    sendpkt.stream = message.stream;
+    sendpkt.ssn = s->nextssn[message.stream];
+    s->nextssn[message.stream] = (s->nextssn[message.stream] + 1) % SSNSPACE;
+    sendpkt.length = message.length;
     for ( i=0; i<20 ; i++ )
       sendpkt.payload[i] = message.data[i];
     sendpkt.checksum = ComputeChecksum(sendpkt);
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    buffer[A_nextseqnum] = sendpkt;
-    acked[A_nextseqnum] = false;
+    s->buffer[s->A_nextseqnum] = sendpkt;
+    s->acked[s->A_nextseqnum] = false;
 
     /* send out packet */
     if (TRACE > 0)
@@ -93,13 +133,13 @@ void A_output(struct msg message)
     tolayer3 (A, sendpkt);
 
     /* start timer if first packet in window */
-    if (base == A_nextseqnum) {
-      starttimer(A, RTT);
-      timer_index = A_nextseqnum;
+    if (s->base == s->A_nextseqnum) {
+      starttimer(A, s->rtt);
+      s->timer_index = s->A_nextseqnum;
     }
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    s->A_nextseqnum = (s->A_nextseqnum + 1) % s->seqspace;
   }
   /* if blocked,  window is full */
   else {
@@ -113,8 +153,9 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
-{  
+static void A_input(void *self, struct pkt packet)
+{
+  struct sr *s = self;
   int ack;
 
   /* if received ACK is not corrupted */
@@ -123,25 +164,27 @@ void A_input(struct pkt packet)
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
     total_ACKs_received++;
-    
-    if (!acked[ack]) {
+
+    /* only ACKs for packets in the window are new */
+    if ((ack - s->base + s->seqspace) % s->seqspace < (s->A_nextseqnum - s->base + s->seqspace) % s->seqspace &&
+        !s->acked[ack]) {
       if (TRACE > 0)
         printf("----A: ACK %d is not a duplicate\n",packet.acknum);
       new_ACKs++;
-      acked[ack] = true;
+      s->acked[ack] = true;
 
-      while (acked[base]) {
-        acked[base] = false;
-        base = (base + 1) % SEQSPACE;
+      while (s->base != s->A_nextseqnum && s->acked[s->base]) {
+        s->acked[s->base] = false;
+        s->base = (s->base + 1) % s->seqspace;
       }
 
       stoptimer(A);
 
-      if (base != A_nextseqnum) {
-        timer_index = base;
-        starttimer(A, RTT);
+      if (s->base != s->A_nextseqnum) {
+        s->timer_index = s->base;
+        starttimer(A, s->rtt);
       } else {
-        timer_index = -1;
+        s->timer_index = -1;
       }
         }
         else
@@ -154,33 +197,70 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void *self)
 {
-  
+  struct sr *s = self;
+
   if (TRACE > 0){
     printf("----A: time out,resend packets!\n");
   }
-    if (timer_index != -1 && !acked[timer_index]) {
-      printf ("---A: resending packet %d\n", (buffer[timer_index]).seqnum);
-      tolayer3(A,buffer[timer_index]);
+    if (s->timer_index != -1 && !s->acked[s->timer_index]) {
+      printf ("---A: resending packet %d\n", (s->buffer[s->timer_index]).seqnum);
+      tolayer3(A,s->buffer[s->timer_index]);
       packets_resent++;
-      starttimer(A,RTT);
+      starttimer(A,s->rtt);
     }
 }
 
+/* number of packets sent but not yet acknowledged, for progress reports */
+static int A_occupancy(void *self)
+{
+  struct sr *s = self;
+
+  return (s->A_nextseqnum + s->seqspace - s->base) % s->seqspace;
+}
+
+/* size of the send window, for sources that keep it full */
+static int A_window(void *self)
+{
+  struct sr *s = self;
+
+  return s->window;
+}
+
+/* B's window only covers a second copy of seqnum once it has moved past
+   the packet seqspace - window numbers on */
+static int aliases(void *self, int seqnum, int later)
+{
+  struct sr *s = self;
+
+  return later == (seqnum + s->seqspace - s->window) % s->seqspace;
+}
+
+/* number of out of order packets buffered at B, for the time series */
+static int B_occupancy(void *self)
+{
+  struct sr *s = self;
+  int i, n = 0;
+
+  for (i = 0; i < s->seqspace; i++)
+    if (s->received[i] && !s->delivered[i])
+      n++;
+  return n;
+}
 
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(struct sr *s)
 {
   int i;
-  A_nextseqnum = 0;
-  base = 0;
-  timer_index = -1;
+  s->A_nextseqnum = 0;
+  s->base = 0;
+  s->timer_index = -1;
 
-  for (i = 0; i < SEQSPACE; i++) {
-    acked[i] = false;
+  for (i = 0; i < s->seqspace; i++) {
+    s->acked[i] = false;
   }
 }
 
@@ -188,24 +268,39 @@ void A_init(void)
 
 /********* Receiver (B)  variables and procedures ************/
 
-static struct pkt recv_buffer[SEQSPACE];  /* buffer for out-of-order packets */
-static bool received[SEQSPACE];           /* whether a packet is buffered */
-static int expectedseqnum;                /* the sequence number expected next by the receiver */
-static int B_nextseqnum;                  /* the sequence number for the next packets sent by B */
+/* give layer 5 the buffered packets of stream that are now in order.  A
+   stream's packets have increasing seqnums, so one pass over the window
+   finds them in order */
+static void deliver_stream(struct sr *s, int stream)
+{
+  int i, q;
+
+  for (i = 0; i < s->window; i++) {
+    q = (s->expectedseqnum + i) % s->seqspace;
+    if (s->received[q] && !s->delivered[q] && s->recv_buffer[q].stream == stream &&
+        s->recv_buffer[q].ssn == s->expectedssn[stream]) {
+      tolayer5_stream(B, stream, s->recv_buffer[q].payload,
+                      s->recv_buffer[q].length);
+      s->delivered[q] = true;
+      s->expectedssn[stream] = (s->expectedssn[stream] + 1) % SSNSPACE;
+    }
+  }
+}
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void B_input(void *self, struct pkt packet)
 {
+  struct sr *s = self;
   struct pkt sendpkt;
   int i;
 
   /* if not corrupted and received packet is in order */
-  if (!IsCorrupted(packet) &&
-      ((packet.seqnum - expectedseqnum + SEQSPACE) % SEQSPACE < WINDOWSIZE)) {
+  if (!IsCorrupted(packet) && packet.stream >= 0 && packet.stream < MAXSTREAMS &&
+      ((packet.seqnum - s->expectedseqnum + s->seqspace) % s->seqspace < s->window)) {
 
-    if (!received[packet.seqnum]) {
-      recv_buffer[packet.seqnum] = packet;
-      received[packet.seqnum] = true;
+    if (!s->received[packet.seqnum]) {
+      s->recv_buffer[packet.seqnum] = packet;
+      s->received[packet.seqnum] = true;
       if (TRACE > 0)
         printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
       packets_received++;
@@ -215,32 +310,44 @@ void B_input(struct pkt packet)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
   }
 */
-    while (received[expectedseqnum]) {
-      
-      tolayer5(B, recv_buffer[expectedseqnum].payload);
-      received[expectedseqnum] = false;
-      expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    deliver_stream(s, packet.stream);
+
+    /* the window moves past packets once they are delivered; an earlier
+       packet of their stream is always below them, so none is left behind */
+    while (s->received[s->expectedseqnum] && s->delivered[s->expectedseqnum]) {
+      s->received[s->expectedseqnum] = false;
+      s->delivered[s->expectedseqnum] = false;
+      s->expectedseqnum = (s->expectedseqnum + 1) % s->seqspace;
     }
 
     sendpkt.acknum = packet.seqnum;
 
   }
+  else if (!IsCorrupted(packet)) {
+    /* already delivered: its ACK was lost, so acknowledge it again */
+    if (TRACE > 0)
+      printf("----B: packet %d was already received, resend its ACK!\n", packet.seqnum);
+    sendpkt.acknum = packet.seqnum;
+  }
   else {
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0){
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
     }
 
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
+    if (s->expectedseqnum == 0)
+      sendpkt.acknum = s->seqspace - 1;
     else
-      sendpkt.acknum = expectedseqnum - 1;
+      sendpkt.acknum = s->expectedseqnum - 1;
   }
 
   /* create packet */
   sendpkt.seqnum = 0;
+  sendpkt.stream = NOTINUSE;
+  sendpkt.ssn = NOTINUSE;
+  sendpkt.length = 0;
 
-  /* we don't have any data to send.  fill payload with 0's */
+  /* we don't have any data to send.  fill payload with 0's, none of it sent */
   for ( i=0; i<20 ; i++ )
     sendpkt.payload[i] = '0';
 
@@ -253,33 +360,96 @@ void B_input(struct pkt packet)
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(struct sr *s)
 {
   int i, j;
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
-  
-  for (i = 0; i < SEQSPACE; i++) {
-    received[i] = false;
-    recv_buffer[i].seqnum = -1;
-    recv_buffer[i].acknum = -1;
-    recv_buffer[i].checksum = -1;
+  s->expectedseqnum = 0;
+  s->B_nextseqnum = 1;
+
+  for (i = 0; i < s->seqspace; i++) {
+    s->received[i] = false;
+    s->delivered[i] = false;
+    s->recv_buffer[i].seqnum = -1;
+    s->recv_buffer[i].acknum = -1;
+    s->recv_buffer[i].checksum = -1;
+    s->recv_buffer[i].stream = -1;
+    s->recv_buffer[i].ssn = -1;
+    s->recv_buffer[i].length = 0;
     for (j = 0; j < 20; j++) {
-      recv_buffer[i].payload[j] = 0;
+      s->recv_buffer[i].payload[j] = 0;
     }
   }
 }
 
+/* save or restore the sender and receiver state in a snapshot */
+static void checkpoint(void *self, struct ckpt *c)
+{
+  struct sr *s = self;
+
+  ckpt_tag(c, "SR");
+  CKPT_IO(c, *s);
+}
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(void *self, struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void *self)
 {
 }
+
+/* Selective Repeat needs twice the window in sequence numbers, or a
+   resent packet could be taken for a new one */
+static int params_ok(const struct protoparams *p)
+{
+  return p->window >= 1 && p->window <= MAXWINDOW && p->seqspace >= 2 * p->window &&
+         p->seqspace <= MAXSEQSPACE && p->rtt > 0.0;
+}
+
+/* create an instance with both entities initialised */
+static void *create(const struct protoparams *p)
+{
+  struct sr *s = calloc(1, sizeof(struct sr));
+
+  if (s == NULL) {
+    printf("memory allocation for protocol failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->window = p->window;
+  s->seqspace = p->seqspace;
+  s->rtt = p->rtt;
+  A_init(s);
+  B_init(s);
+  return s;
+}
+
+static void destroy(void *self)
+{
+  free(self);
+}
+
+const struct protocol sr_protocol = {
+  "sr",
+  { WINDOWSIZE, SEQSPACE, RTT },
+  params_ok,
+  create,
+  destroy,
+  A_output,
+  A_input,
+  A_timerinterrupt,
+  B_output,
+  B_input,
+  B_timerinterrupt,
+  A_occupancy,
+  A_window,
+  B_occupancy,
+  ComputeChecksum,
+  aliases,
+  checkpoint
+};
@@ -0,0 +1,613 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "link.h"
+#include "topo.h"
+
+/* ******************************************************************
+   Topology file format, one item per line, '#' starts a comment:
+
+     nodes <n>                                 node 0 is A, node 1 is B
+     link <u> <v> <delay> <loss> <qlimit> <rate>
+     flow <src> <dst> <interval> <count> <bytes>
+
+   A link line creates both directions with the same parameters; rate
+   is in bytes per time unit (0 = infinite) and qlimit in packets
+   (0 = unlimited).  A flow sends count packets of the given size from
+   one router to another with exponentially distributed gaps of mean
+   interval.  Packets follow the fewest-hop path; A and B never forward.
+
+   Execution: partition 0 is the main thread and holds A and B, routers
+   are spread in contiguous blocks over partitions 1..nthreads.  Each
+   window every partition first takes in the packets other partitions
+   sent it, then the earliest pending time T over all partitions is
+   found, and each partition processes its events before T + lookahead.
+   Events that cross partitions go through one outbox per ordered pair
+   of partitions, so no locks are needed besides the barriers.
+
+   Each link and flow has its own random stream and events are ordered
+   by (time, originating node, per-node serial), so results do not
+   depend on the number of threads.
+**********************************************************************/
+
+/* event kinds */
+#define EV_ARRIVE 0      /* packet arrives at a node */
+#define EV_SOURCE 1      /* flow source emits its next packet */
+
+#define PROTOCOL_FLOW (-1)   /* flow id of packets sent by A and B */
+
+struct hop {             /* one direction of a link */
+  int from, to;
+  simtime_t delay;
+  double loss;
+  double rate;
+  int qlimit;
+  struct link q;         /* FIFO and transmitter */
+  unsigned long long rng;
+  long long lost;
+};
+
+struct node {
+  int part;              /* partition that owns the node */
+  long long serial;      /* events originated here, for tie breaking */
+};
+
+struct flow {
+  int src, dst;
+  double interval;
+  long long count;
+  int bytes;
+  unsigned long long rng;
+  long long sent;        /* written by the source's partition */
+  long long delivered;   /* written by the destination's partition */
+  simtime_t latsum;
+  simtime_t latmax;
+};
+
+struct hopev {
+  simtime_t time;
+  int origin;            /* node that created the event */
+  long long serial;
+  int kind;
+  int node;              /* node where the event happens */
+  int flow;              /* flow id, or PROTOCOL_FLOW */
+  int dst;               /* final destination node */
+  simtime_t born;        /* time the packet entered the network */
+  struct pkt pkt;        /* protocol packet, if flow == PROTOCOL_FLOW */
+  int bytes;             /* ... and its size on the wire */
+};
+
+struct evbuf {           /* heap (partition queue) or plain array (outbox) */
+  struct hopev *ev;
+  int n, cap;
+};
+
+struct part {
+  struct evbuf heap;
+  simtime_t next;        /* earliest pending event after taking in the outboxes */
+  long long events;
+  long long crossed;     /* events handed to other partitions */
+  long long dropped[2];  /* protocol packets lost on the way, by sender */
+  pthread_t thread;
+};
+
+int topo_active = 0;
+
+static const char *toponame;
+static int nnodes, nhops, nflows, nparts;
+static struct node *nodes;
+static struct hop *hops;
+static struct flow *flows;
+static int *route;                 /* route[u*nnodes+d]: hop to take from u towards d */
+static simtime_t lookahead;
+
+static struct part *parts;
+static struct evbuf *outbox;       /* outbox[from*nparts+to] */
+static const struct topo_hooks *hooks;
+static pthread_barrier_t barrier;
+static simtime_t horizon;
+static int finished;
+static long long windows;
+/* protocol packets per sender, kept by the main thread: handed in, handed
+   back out to A or B, and lost as of the end of the last window */
+static long long injected[2], arrived[2], lost[2];
+
+static void topo_fail(int line, const char *what)
+{
+  if (line > 0)
+    printf("topology %s line %d: %s\n", toponame, line, what);
+  else
+    printf("topology %s: %s\n", toponame, what);
+  exit(EXIT_FAILURE);
+}
+
+static void *topo_alloc(size_t n)
+{
+  void *p = calloc(n, 1);
+
+  if (p == NULL) {
+    printf("memory allocation for topology failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* uniform on [0,1), splitmix64 */
+static double nextrand(unsigned long long *state)
+{
+  unsigned long long z;
+
+  z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/********************* LOADING ****************************/
+
+/* fewest-hop routes; breadth first from every destination over reversed
+   links, never expanding through the endpoints A and B */
+static void computeroutes(void)
+{
+  int *queue = topo_alloc(nnodes * sizeof(int));
+  int d, u, h, head, tail;
+
+  route = topo_alloc((size_t)nnodes * nnodes * sizeof(int));
+  for (u = 0; u < nnodes * nnodes; u++)
+    route[u] = -1;
+  for (d = 0; d < nnodes; d++) {
+    head = tail = 0;
+    queue[tail++] = d;
+    while (head < tail) {
+      u = queue[head++];
+      if (u != d && (u == A || u == B))
+        continue;
+      for (h = 0; h < nhops; h++)
+        if (hops[h].to == u && hops[h].from != d &&
+            route[hops[h].from * nnodes + d] < 0) {
+          route[hops[h].from * nnodes + d] = h;
+          queue[tail++] = hops[h].from;
+        }
+    }
+  }
+  free(queue);
+}
+
+void topo_load(const char *name, int nthreads)
+{
+  FILE *fp;
+  char line[256], word[16];
+  struct hop *h;
+  struct flow *f;
+  double delay, loss, rate, interval;
+  long long count;
+  int lineno = 0, u, v, qlimit, bytes, i, maxhops = 0, maxflows = 0;
+
+  toponame = name;
+  fp = fopen(name, "r");
+  if (fp == NULL)
+    topo_fail(0, "cannot open file");
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if (strchr(line, '#') != NULL)
+      *strchr(line, '#') = '\0';
+    if (sscanf(line, "%15s", word) != 1)
+      continue;
+    if (strcmp(word, "nodes") == 0) {
+      if (nodes != NULL || sscanf(line, "%*s %d", &nnodes) != 1 || nnodes < 2)
+        topo_fail(lineno, "expected: nodes <n>, n >= 2, once");
+      nodes = topo_alloc(nnodes * sizeof(struct node));
+    }
+    else if (strcmp(word, "link") == 0) {
+      if (nodes == NULL ||
+          sscanf(line, "%*s %d %d %lf %lf %d %lf", &u, &v, &delay, &loss, &qlimit, &rate) != 6 ||
+          u < 0 || v < 0 || u >= nnodes || v >= nnodes || u == v || delay <= 0.0)
+        topo_fail(lineno, "expected: link <u> <v> <delay> <loss> <qlimit> <rate>, delay > 0");
+      if (nhops + 2 > maxhops) {
+        maxhops = 2 * maxhops + 2;
+        hops = realloc(hops, maxhops * sizeof(struct hop));
+        if (hops == NULL)
+          topo_fail(0, "out of memory");
+      }
+      for (i = 0; i < 2; i++) {
+        h = &hops[nhops++];
+        memset(h, 0, sizeof(*h));
+        h->from = i ? v : u;
+        h->to = i ? u : v;
+        h->delay = UNITS_TO_TICKS(delay);
+        h->loss = loss;
+        h->qlimit = qlimit;
+        h->rate = rate;
+      }
+    }
+    else if (strcmp(word, "flow") == 0) {
+      if (nodes == NULL ||
+          sscanf(line, "%*s %d %d %lf %lld %d", &u, &v, &interval, &count, &bytes) != 5 ||
+          u < 2 || v < 2 || u >= nnodes || v >= nnodes || u == v || interval <= 0.0)
+        topo_fail(lineno, "expected: flow <src> <dst> <interval> <count> <bytes> between routers");
+      if (nflows + 1 > maxflows) {
+        maxflows = 2 * maxflows + 1;
+        flows = realloc(flows, maxflows * sizeof(struct flow));
+        if (flows == NULL)
+          topo_fail(0, "out of memory");
+      }
+      f = &flows[nflows++];
+      memset(f, 0, sizeof(*f));
+      f->src = u;
+      f->dst = v;
+      f->interval = interval;
+      f->count = count;
+      f->bytes = bytes;
+    }
+    else
+      topo_fail(lineno, "unknown keyword");
+  }
+  fclose(fp);
+  if (nodes == NULL || nhops == 0)
+    topo_fail(0, "needs a nodes line and at least one link");
+
+  lookahead = hops[0].delay;
+  for (i = 1; i < nhops; i++)
+    if (hops[i].delay < lookahead)
+      lookahead = hops[i].delay;
+
+  computeroutes();
+  if (route[A * nnodes + B] < 0 || route[B * nnodes + A] < 0)
+    topo_fail(0, "no path between A and B");
+  for (i = 0; i < nflows; i++)
+    if (route[flows[i].src * nnodes + flows[i].dst] < 0)
+      topo_fail(0, "flow between unconnected routers");
+
+  /* A and B in partition 0, routers in contiguous blocks over the rest */
+  if (nthreads > nnodes - 2)
+    nthreads = nnodes - 2;
+  nparts = (nthreads < 1 ? 1 : nthreads) + 1;
+  for (u = 2; u < nnodes; u++)
+    nodes[u].part = 1 + (int)((long long)(u - 2) * (nparts - 1) / (nnodes - 2));
+  parts = topo_alloc(nparts * sizeof(struct part));
+  outbox = topo_alloc(nparts * nparts * sizeof(struct evbuf));
+  topo_active = 1;
+}
+
+/********************* EVENT QUEUES ************************/
+
+static int before(const struct hopev *x, const struct hopev *y)
+{
+  if (x->time != y->time)
+    return x->time < y->time;
+  if (x->origin != y->origin)
+    return x->origin < y->origin;
+  return x->serial < y->serial;
+}
+
+static int cmpev(const void *x, const void *y)
+{
+  return before(x, y) ? -1 : before(y, x) ? 1 : 0;
+}
+
+static void append(struct evbuf *b, const struct hopev *e)
+{
+  if (b->n == b->cap) {
+    b->cap = b->cap ? 2 * b->cap : 64;
+    b->ev = realloc(b->ev, b->cap * sizeof(struct hopev));
+    if (b->ev == NULL) {
+      printf("memory allocation for topology failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  b->ev[b->n++] = *e;
+}
+
+static void heappush(struct evbuf *b, const struct hopev *e)
+{
+  struct hopev tmp;
+  int i, parent;
+
+  append(b, e);
+  for (i = b->n - 1; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (!before(&b->ev[i], &b->ev[parent]))
+      break;
+    tmp = b->ev[i];
+    b->ev[i] = b->ev[parent];
+    b->ev[parent] = tmp;
+  }
+}
+
+static void heappop(struct evbuf *b, struct hopev *e)
+{
+  struct hopev tmp;
+  int i, child;
+
+  *e = b->ev[0];
+  b->ev[0] = b->ev[--b->n];
+  for (i = 0; (child = 2 * i + 1) < b->n; i = child) {
+    if (child + 1 < b->n && before(&b->ev[child + 1], &b->ev[child]))
+      child++;
+    if (!before(&b->ev[child], &b->ev[i]))
+      break;
+    tmp = b->ev[i];
+    b->ev[i] = b->ev[child];
+    b->ev[child] = tmp;
+  }
+}
+
+/********************* FORWARDING **************************/
+
+/* a protocol packet reaches A or B; main thread only */
+static void handout(struct hopev *e)
+{
+  arrived[1 - e->node]++;
+  hooks->deliver(e->node, &e->pkt, e->time);
+}
+
+/* hand event e (already addressed to e->node at e->time) to whoever owns it */
+static void post(int from, struct hopev *e)
+{
+  int to = nodes[e->node].part;
+
+  if (e->node == A || e->node == B) {
+    if (from == 0)
+      handout(e);
+    else {
+      append(&outbox[from * nparts], e);
+      parts[from].crossed++;
+    }
+  }
+  else if (to == from)
+    heappush(&parts[from].heap, e);
+  else {
+    append(&outbox[from * nparts + to], e);
+    parts[from].crossed++;
+  }
+}
+
+/* send the packet in e from node u at time t towards its destination */
+static void forward(int part, int u, struct hopev *e, simtime_t t)
+{
+  struct hop *h;
+  simtime_t depart = t;
+  int bytes;
+
+  h = &hops[route[u * nnodes + e->dst]];
+  bytes = (e->flow == PROTOCOL_FLOW) ? e->bytes : flows[e->flow].bytes;
+  if (h->loss > 0.0 && nextrand(&h->rng) < h->loss)
+    h->lost++;
+  else if (h->rate <= 0.0 || link_send(&h->q, t, bytes, &depart) == LINK_SENT) {
+    e->kind = EV_ARRIVE;
+    e->node = h->to;
+    e->time = depart + h->delay;
+    e->origin = u;
+    e->serial = nodes[u].serial++;
+    post(part, e);
+    return;
+  }
+  if (e->flow == PROTOCOL_FLOW)
+    parts[part].dropped[1 - e->dst]++;
+}
+
+static void handle(int part, struct hopev *e)
+{
+  struct flow *f;
+  struct hopev next;
+  simtime_t latency;
+
+  if (e->kind == EV_SOURCE) {
+    f = &flows[e->flow];
+    if (f->sent >= f->count)
+      return;
+    f->sent++;
+    next = *e;                  /* schedule the source's next packet */
+    next.time = e->time + UNITS_TO_TICKS(-f->interval * log1p(-nextrand(&f->rng)));
+    next.serial = nodes[e->node].serial++;
+    heappush(&parts[part].heap, &next);
+    e->born = e->time;
+    forward(part, e->node, e, e->time);
+  }
+  else if (e->node == e->dst) {
+    f = &flows[e->flow];
+    latency = e->time - e->born;
+    f->delivered++;
+    f->latsum += latency;
+    if (latency > f->latmax)
+      f->latmax = latency;
+  }
+  else
+    forward(part, e->node, e, e->time);
+}
+
+/* take in everything the other partitions sent to partition p */
+static void takein(int p)
+{
+  struct evbuf *b;
+  int q, i;
+
+  for (q = 0; q < nparts; q++) {
+    b = &outbox[q * nparts + p];
+    if (p == 0 && b->n > 1)
+      qsort(b->ev, b->n, sizeof(struct hopev), cmpev);
+    for (i = 0; i < b->n; i++) {
+      if (p == 0)
+        handout(&b->ev[i]);
+      else
+        heappush(&parts[p].heap, &b->ev[i]);
+    }
+    b->n = 0;
+  }
+}
+
+/* one partition's part of a window */
+static void process(int p)
+{
+  struct hopev e;
+  struct evbuf *heap = &parts[p].heap;
+
+  while (heap->n > 0 && heap->ev[0].time < horizon) {
+    heappop(heap, &e);
+    handle(p, &e);
+    parts[p].events++;
+  }
+}
+
+static void *worker(void *arg)
+{
+  int p = (int)(long)arg;
+
+  while (1) {
+    takein(p);
+    parts[p].next = parts[p].heap.n > 0 ? parts[p].heap.ev[0].time : SIMTIME_MAX;
+    pthread_barrier_wait(&barrier);    /* everyone has published its next time */
+    pthread_barrier_wait(&barrier);    /* main has set the horizon */
+    if (finished)
+      return NULL;
+    process(p);
+    pthread_barrier_wait(&barrier);    /* window done, outboxes complete */
+  }
+}
+
+/********************* DRIVER ******************************/
+
+/* start a run; seed is the run's seed, so replications see independent
+   router losses and background traffic */
+static void resetrun(unsigned int seed)
+{
+  struct hopev e;
+  int i;
+
+  for (i = 0; i < nnodes; i++)
+    nodes[i].serial = 0;
+  for (i = 0; i < nhops; i++) {
+    link_free(&hops[i].q);
+    link_init(&hops[i].q, hops[i].rate, hops[i].qlimit, AQM_DROPTAIL, i);
+    hops[i].rng = 0x5851f42d4c957f2dULL * (i + 1) ^ 0xd1342543de82ef95ULL * seed;
+    hops[i].lost = 0;
+  }
+  for (i = 0; i < nparts; i++) {
+    parts[i].heap.n = 0;
+    parts[i].events = 0;
+    parts[i].crossed = 0;
+    parts[i].dropped[A] = parts[i].dropped[B] = 0;
+  }
+  injected[A] = injected[B] = 0;
+  arrived[A] = arrived[B] = 0;
+  lost[A] = lost[B] = 0;
+  for (i = 0; i < nparts * nparts; i++)
+    outbox[i].n = 0;
+  windows = 0;
+  finished = 0;
+
+  /* first emission of every flow */
+  for (i = 0; i < nflows; i++) {
+    flows[i].rng = 0x2545f4914f6cdd1dULL * (i + 1) ^ 0xd1342543de82ef95ULL * seed;
+    flows[i].sent = flows[i].delivered = 0;
+    flows[i].latsum = flows[i].latmax = 0;
+    memset(&e, 0, sizeof(e));
+    e.kind = EV_SOURCE;
+    e.node = e.origin = flows[i].src;
+    e.flow = i;
+    e.dst = flows[i].dst;
+    e.serial = nodes[e.node].serial++;
+    e.time = UNITS_TO_TICKS(-flows[i].interval * log1p(-nextrand(&flows[i].rng)));
+    heappush(&parts[nodes[e.node].part].heap, &e);
+  }
+}
+
+/* run a whole simulation: the emulator's events in partition 0 on this
+   thread, routers on nparts-1 worker threads */
+void topo_run(const struct topo_hooks *h, unsigned int seed)
+{
+  simtime_t t;
+  int i;
+
+  hooks = h;
+  resetrun(seed);
+  pthread_barrier_init(&barrier, NULL, nparts);
+  for (i = 1; i < nparts; i++)
+    if (pthread_create(&parts[i].thread, NULL, worker, (void *)(long)i) != 0)
+      topo_fail(0, "cannot create thread");
+
+  while (1) {
+    takein(0);
+    parts[0].next = hooks->nextevent();
+    pthread_barrier_wait(&barrier);
+    t = SIMTIME_MAX;
+    for (i = 0; i < nparts; i++)
+      if (parts[i].next < t)
+        t = parts[i].next;
+    finished = (t == SIMTIME_MAX);
+    horizon = finished ? t : t + lookahead;
+    pthread_barrier_wait(&barrier);
+    if (finished)
+      break;
+    hooks->rununtil(horizon);
+    pthread_barrier_wait(&barrier);
+    windows++;
+    lost[A] = lost[B] = 0;
+    for (i = 0; i < nparts; i++) {
+      lost[A] += parts[i].dropped[A];
+      lost[B] += parts[i].dropped[B];
+    }
+  }
+
+  for (i = 1; i < nparts; i++)
+    pthread_join(parts[i].thread, NULL);
+  pthread_barrier_destroy(&barrier);
+}
+
+/* packet of bytes on the wire handed to tolayer3 by A or B at time now */
+void topo_inject(int AorB, const struct pkt *packet, int bytes, simtime_t now)
+{
+  struct hopev e;
+
+  memset(&e, 0, sizeof(e));
+  e.flow = PROTOCOL_FLOW;
+  e.dst = (AorB + 1) % 2;
+  e.born = now;
+  e.pkt = *packet;
+  e.bytes = bytes;
+  injected[AorB]++;
+  forward(0, AorB, &e, now);
+}
+
+/* protocol packets sent by AorB still inside the topology; losses in
+   other partitions are only counted at the end of each window */
+int topo_intransit(int AorB)
+{
+  return (int)(injected[AorB] - arrived[AorB] - lost[AorB]);
+}
+
+void topo_report(simtime_t now)
+{
+  struct flow *f;
+  char name[32];
+  long long events = 0, crossings = 0;
+  int i;
+
+  for (i = 0; i < nparts; i++) {
+    events += parts[i].events;
+    crossings += parts[i].crossed;
+  }
+  printf("topology %s: %d nodes, %d links, %d partitions, lookahead %f\n",
+         toponame, nnodes, nhops / 2, nparts, TICKS_TO_UNITS(lookahead));
+  printf("topology: %lld windows, %lld router events, %lld events crossed partitions\n",
+         windows, events, crossings);
+  for (i = 0; i < nhops; i++) {
+    if (hops[i].lost > 0)
+      printf("hop %d->%d: packets lost: %lld\n", hops[i].from, hops[i].to, hops[i].lost);
+    if (hops[i].rate > 0.0 && hops[i].q.offered > 0) {
+      sprintf(name, "%d->%d", hops[i].from, hops[i].to);
+      link_report(&hops[i].q, name, now);
+    }
+  }
+  for (i = 0; i < nflows; i++) {
+    f = &flows[i];
+    printf("flow %d (%d->%d): sent: %lld, delivered: %lld, mean latency: %f, max latency: %f\n",
+           i, f->src, f->dst, f->sent, f->delivered,
+           f->delivered > 0 ? TICKS_TO_UNITS(f->latsum) / f->delivered : 0.0,
+           TICKS_TO_UNITS(f->latmax));
+  }
+}
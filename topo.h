@@ -0,0 +1,30 @@
+/* ******************************************************************
+   Multi-hop topology emulation.
+
+   Instead of the single A<->B channel, packets handed to tolayer3 can
+   be routed over a graph of store-and-forward hops read from a file.
+   Every link has its own propagation delay, loss probability, FIFO and
+   rate, and background flows between routers load the queues.
+
+   Routers are partitioned over worker threads, each with its own event
+   queue.  The endpoints A and B (and so the protocol entities) stay in
+   partition 0 on the main thread.  Partitions advance together in
+   windows of simulated time no longer than the smallest link delay (the
+   lookahead), which is the conservative guarantee that no packet sent
+   during a window can arrive in another partition within that window.
+**********************************************************************/
+
+/* what the topology engine needs from the emulator's own event loop */
+struct topo_hooks {
+  simtime_t (*nextevent)(void);                /* time of the next emulator event */
+  void (*rununtil)(simtime_t horizon);         /* dispatch emulator events before horizon */
+  void (*deliver)(int AorB, struct pkt *packet, simtime_t when);  /* packet reaches A or B */
+};
+
+extern int topo_active;
+
+extern void topo_load(const char *name, int nthreads);
+extern void topo_run(const struct topo_hooks *hooks, unsigned int seed);
+extern void topo_inject(int AorB, const struct pkt *packet, int bytes, simtime_t now);
+extern int topo_intransit(int AorB);
+extern void topo_report(simtime_t now);
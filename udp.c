@@ -0,0 +1,268 @@
+#ifdef __linux__
+#define _GNU_SOURCE             /* recvmmsg, sendmmsg */
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "udp.h"
+
+int udp_active = 0;
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define UDP_BATCH  64           /* packets per sendmmsg/recvmmsg call */
+#define UDP_RCVBUF (1 << 20)    /* socket receive buffer, bytes */
+#define TIMER_TAG  2            /* epoll tag of the timerfd; sockets use A and B */
+
+static double nsperunit;        /* wall clock nanoseconds per time unit */
+static int sock[2];             /* socket of each entity */
+static int epfd, tfd;
+static struct timespec start;   /* wall clock time of simulated time 0 */
+static const struct udp_hooks *hooks;
+
+/* packets waiting to be sent, per sending entity */
+static struct pkt outq[2][UDP_BATCH];
+static int outn[2];
+
+/* statistics */
+static long long sent[2], received[2], senddrops;
+static long long sendcalls, recvcalls, wakeups;
+static double walltime;
+
+static void udp_fail(const char *what)
+{
+  printf("udp backend: %s: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/* wall clock time since start, in ticks */
+static simtime_t wallticks(void)
+{
+  struct timespec ts;
+  double ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ns = (ts.tv_sec - start.tv_sec) * 1e9 + (ts.tv_nsec - start.tv_nsec);
+  return (simtime_t)(ns / nsperunit * TICKS_PER_UNIT);
+}
+
+/* wake the loop at simulated time t, or never */
+static void armtimer(simtime_t t)
+{
+  struct itimerspec it;
+  double ns;
+
+  memset(&it, 0, sizeof(it));
+  if (t != SIMTIME_MAX) {
+    ns = TICKS_TO_UNITS(t) * nsperunit + start.tv_nsec;
+    it.it_value.tv_sec = start.tv_sec + (time_t)(ns / 1e9);
+    it.it_value.tv_nsec = (long)(ns - (double)(time_t)(ns / 1e9) * 1e9);
+    if (it.it_value.tv_sec == 0 && it.it_value.tv_nsec == 0)
+      it.it_value.tv_nsec = 1;  /* all zero would disarm the timer */
+  }
+  if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &it, NULL) != 0)
+    udp_fail("timerfd_settime");
+}
+
+void udp_open(double usecperunit)
+{
+  struct sockaddr_in addr[2];
+  struct epoll_event ev;
+  socklen_t len;
+  int i, size = UDP_RCVBUF;
+
+  if (usecperunit <= 0.0) {
+    printf("udp backend: microseconds per time unit must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+  nsperunit = usecperunit * 1000.0;
+  for (i = 0; i < 2; i++) {
+    sock[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock[i] < 0)
+      udp_fail("socket");
+    setsockopt(sock[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&addr[i], 0, sizeof(addr[i]));
+    addr[i].sin_family = AF_INET;
+    addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(addr[i]);
+    if (bind(sock[i], (struct sockaddr *)&addr[i], sizeof(addr[i])) != 0 ||
+        getsockname(sock[i], (struct sockaddr *)&addr[i], &len) != 0)
+      udp_fail("bind");
+  }
+  if (connect(sock[A], (struct sockaddr *)&addr[B], sizeof(addr[B])) != 0 ||
+      connect(sock[B], (struct sockaddr *)&addr[A], sizeof(addr[A])) != 0)
+    udp_fail("connect");
+
+  if ((epfd = epoll_create1(0)) < 0)
+    udp_fail("epoll_create1");
+  if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0)
+    udp_fail("timerfd_create");
+  for (i = 0; i < 3; i++) {
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, i == TIMER_TAG ? tfd : sock[i], &ev) != 0)
+      udp_fail("epoll_ctl");
+  }
+  udp_active = 1;
+}
+
+/* send everything queued by AorB in as few system calls as possible */
+static void flush(int AorB)
+{
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  int i, n, done = 0;
+
+  if (outn[AorB] == 0)
+    return;
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0; i < outn[AorB]; i++) {
+    iov[i].iov_base = &outq[AorB][i];
+    iov[i].iov_len = sizeof(struct pkt);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (done < outn[AorB]) {
+    n = sendmmsg(sock[AorB], msgs + done, outn[AorB] - done, 0);
+    sendcalls++;
+    if (n < 0) {
+      if (errno != EAGAIN && errno != ENOBUFS && errno != ECONNREFUSED)
+        udp_fail("sendmmsg");
+      n = 1;                    /* the socket is full: that packet is lost */
+      senddrops++;
+    }
+    else
+      sent[AorB] += n;
+    done += n;
+  }
+  outn[AorB] = 0;
+}
+
+/* packet handed to tolayer3 by AorB, after the loss and corruption shim */
+void udp_send(int AorB, const struct pkt *packet)
+{
+  outq[AorB][outn[AorB]++] = *packet;
+  if (outn[AorB] == UDP_BATCH)
+    flush(AorB);
+}
+
+/* hand everything waiting at AorB's socket to the emulator */
+static void receive(int AorB, int deliver)
+{
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  struct pkt in[UDP_BATCH];
+  simtime_t t;
+  int i, n;
+
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0; i < UDP_BATCH; i++) {
+    iov[i].iov_base = &in[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  do {
+    n = recvmmsg(sock[AorB], msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      udp_fail("recvmmsg");
+    }
+    recvcalls++;
+    t = wallticks();
+    for (i = 0; i < n; i++)
+      if (deliver && msgs[i].msg_len == sizeof(struct pkt)) {
+        received[AorB]++;
+        hooks->deliver(AorB, &in[i], t);
+      }
+  } while (n == UDP_BATCH);
+}
+
+/* run until the emulator has no events left */
+void udp_run(const struct udp_hooks *h)
+{
+  struct epoll_event evs[3];
+  unsigned long long expirations;
+  simtime_t next;
+  int i, n;
+
+  hooks = h;
+  sent[A] = sent[B] = received[A] = received[B] = 0;
+  senddrops = sendcalls = recvcalls = wakeups = 0;
+  outn[A] = outn[B] = 0;
+  receive(A, 0);                /* discard leftovers of an earlier run */
+  receive(B, 0);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (1) {
+    hooks->rununtil(wallticks() + 1);
+    flush(A);
+    flush(B);
+    if ((next = hooks->nextevent()) == SIMTIME_MAX) {
+      /* no timers left, so nothing the protocol still waits for; loopback
+         delivers synchronously, so whatever was sent is already here */
+      receive(A, 1);
+      receive(B, 1);
+      if (hooks->nextevent() == SIMTIME_MAX)
+        break;
+      continue;
+    }
+    armtimer(next);
+    n = epoll_wait(epfd, evs, 3, -1);
+    if (n < 0 && errno != EINTR)
+      udp_fail("epoll_wait");
+    wakeups++;
+    for (i = 0; i < n; i++) {
+      if (evs[i].data.u32 == TIMER_TAG) {
+        if (read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+          udp_fail("timerfd read");
+      }
+      else
+        receive(evs[i].data.u32, 1);
+    }
+  }
+  walltime = TICKS_TO_UNITS(wallticks()) * nsperunit / 1e9;
+}
+
+void udp_report(void)
+{
+  printf("udp: wall time %f s, %lld packets sent, %lld received, %lld dropped at the socket\n",
+         walltime, sent[A] + sent[B], received[A] + received[B], senddrops);
+  printf("udp: %.0f packets/s, %.2f packets per sendmmsg, %.2f per recvmmsg, %lld wakeups\n",
+         walltime > 0 ? (sent[A] + sent[B]) / walltime : 0.0,
+         sendcalls > 0 ? (double)(sent[A] + sent[B]) / sendcalls : 0.0,
+         recvcalls > 0 ? (double)(received[A] + received[B]) / recvcalls : 0.0, wakeups);
+}
+
+#else  /* !__linux__ */
+
+void udp_open(double usecperunit)
+{
+  printf("udp backend: only available on Linux\n");
+  exit(EXIT_FAILURE);
+}
+
+void udp_run(const struct udp_hooks *hooks)
+{
+}
+
+void udp_send(int AorB, const struct pkt *packet)
+{
+}
+
+void udp_report(void)
+{
+}
+
+#endif
@@ -0,0 +1,26 @@
+/* ******************************************************************
+   Real-socket backend.  Instead of the simulated channel, packets
+   handed to tolayer3 are sent over loopback UDP between two sockets,
+   one per entity, and the emulator's event list (message arrivals and
+   timers) is driven by the wall clock through a timerfd.  One epoll
+   loop waits on both sockets and the timer; sends and receives are
+   batched with sendmmsg/recvmmsg.  The scenario's loss and corruption
+   probabilities still apply in tolayer3, as an in-process shim.
+
+   Simulated time units are mapped to usecperunit microseconds of wall
+   clock time.  Linux only.
+**********************************************************************/
+
+/* what the backend needs from the emulator's own event loop */
+struct udp_hooks {
+  simtime_t (*nextevent)(void);                /* time of the next emulator event */
+  void (*rununtil)(simtime_t horizon);         /* dispatch emulator events before horizon */
+  void (*deliver)(int AorB, struct pkt *packet, simtime_t when);  /* packet reaches A or B */
+};
+
+extern int udp_active;
+
+extern void udp_open(double usecperunit);
+extern void udp_run(const struct udp_hooks *hooks);
+extern void udp_send(int AorB, const struct pkt *packet);
+extern void udp_report(void);
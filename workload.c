@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "emulator.h"
+#include "workload.h"
+#include "checkpoint.h"
+
+#define ONOFF_SHAPE 1.5     /* Pareto shape: infinite variance, finite mean */
+#define ONOFF_BURST 10.0    /* mean messages per burst */
+#define ONOFF_PEAK  10.0    /* rate within a burst, relative to the mean rate */
+
+#define TRACE_CHUNK 4096    /* trace records read at a time */
+#define MSGSIZE     20
+
+extern double jimsrand(void);
+
+int workload_kind = ARRIVE_UNIFORM;
+
+static const char *names[] = { "uniform", "poisson", "onoff", "saturate", "trace", NULL };
+
+/* one line of a trace */
+struct arrival {
+  double time;
+  long long size;
+};
+
+static const char *tracename;
+static FILE *tracefp;
+static struct arrival chunk[TRACE_CHUNK];
+static int chunklen, chunkpos;
+
+/* position in the arrival process, all kept in snapshots */
+struct position {
+  long long records;        /* trace records taken so far */
+  long long partsleft;      /* messages still to offer for the current one */
+  double parttime;          /* ... at this time */
+  long long burstleft;      /* messages left in the current burst */
+  long long bursts;         /* bursts started */
+};
+
+static struct position pos;
+
+static void workload_fail(const char *what)
+{
+  printf("trace %s: %s\n", tracename, what);
+  exit(EXIT_FAILURE);
+}
+
+/* ARRIVE_ constant for a process name, -1 if there is none */
+int workload_byname(const char *name)
+{
+  int i;
+
+  for (i = 0; names[i] != NULL; i++)
+    if (strcmp(names[i], name) == 0)
+      return i;
+  return -1;
+}
+
+/* replay arrivals from a trace file */
+void workload_open(const char *name)
+{
+  workload_kind = ARRIVE_TRACE;
+  tracename = name;
+  tracefp = fopen(name, "r");
+  if (tracefp == NULL)
+    workload_fail("cannot open file");
+}
+
+void workload_close(void)
+{
+  if (tracefp != NULL)
+    fclose(tracefp);
+  tracefp = NULL;
+}
+
+/* start a new run from the beginning of the process.  The trace is
+   opened afresh, since replications in child processes would otherwise
+   share one file offset */
+void workload_reset(void)
+{
+  memset(&pos, 0, sizeof(pos));
+  chunklen = chunkpos = 0;
+  if (tracefp != NULL) {
+    fclose(tracefp);
+    workload_open(tracename);
+  }
+}
+
+/* next trace record; 0 at the end of the trace */
+static int nextrecord(struct arrival *a)
+{
+  if (chunkpos == chunklen) {
+    chunklen = chunkpos = 0;
+    while (chunklen < TRACE_CHUNK &&
+           fscanf(tracefp, "%lf %lld", &chunk[chunklen].time, &chunk[chunklen].size) == 2)
+      chunklen++;
+    if (chunklen == 0) {
+      if (!feof(tracefp))
+        workload_fail("malformed record");
+      return 0;
+    }
+  }
+  *a = chunk[chunkpos++];
+  if (a->time < pos.parttime)
+    workload_fail("arrival times go backwards");
+  pos.records++;
+  return 1;
+}
+
+/* Pareto distributed, with the given mean */
+static double pareto(double mean)
+{
+  double u = jimsrand();
+
+  return mean * (ONOFF_SHAPE - 1) / ONOFF_SHAPE / pow(u > 0.0 ? u : DBL_MIN, 1 / ONOFF_SHAPE);
+}
+
+/* time units from now until the next message, or WORKLOAD_NONE */
+double workload_gap(double now, double lambda)
+{
+  struct arrival a;
+  double u, silence;
+
+  switch (workload_kind) {
+  case ARRIVE_POISSON:
+    u = jimsrand();
+    return -lambda * log(u > 0.0 ? u : DBL_MIN);
+  case ARRIVE_ONOFF:
+    if (pos.burstleft > 0) {
+      pos.burstleft--;
+      return lambda / ONOFF_PEAK;
+    }
+    /* a silence makes up the rest of the burst's share of time */
+    silence = pareto(ONOFF_BURST * lambda - (ONOFF_BURST - 1) * lambda / ONOFF_PEAK);
+    pos.burstleft = (long long)(pareto(ONOFF_BURST) + 0.5);
+    if (pos.burstleft > 0)
+      pos.burstleft--;
+    pos.bursts++;
+    return silence;
+  case ARRIVE_TRACE:
+    if (pos.partsleft == 0) {
+      if (!nextrecord(&a))
+        return WORKLOAD_NONE;
+      pos.partsleft = a.size > MSGSIZE ? (a.size + MSGSIZE - 1) / MSGSIZE : 1;
+      pos.parttime = a.time;
+    }
+    pos.partsleft--;
+    return pos.parttime > now ? pos.parttime - now : 0.0;
+  default:
+    return lambda * jimsrand() * 2;   /* uniform on [0,2*lambda], mean lambda */
+  }
+}
+
+void workload_report(void)
+{
+  if (workload_kind == ARRIVE_ONOFF)
+    printf("workload: onoff, %lld bursts\n", pos.bursts);
+  else if (workload_kind == ARRIVE_TRACE)
+    printf("workload: trace %s, %lld records replayed\n", tracename, pos.records);
+}
+
+/* save or restore the position in the arrival process */
+void workload_checkpoint(struct ckpt *c)
+{
+  struct arrival a;
+  struct position saved;
+  int kind = workload_kind;
+
+  CKPT_IO(c, kind);
+  CKPT_IO(c, pos);
+  if (CKPT_SAVING(c))
+    return;
+  if (kind == ARRIVE_TRACE && tracefp == NULL) {
+    printf("checkpoint %s: the run replays a trace, give it with -l\n", c->name);
+    exit(EXIT_FAILURE);
+  }
+  workload_kind = kind;
+  if (kind == ARRIVE_TRACE) {
+    /* skip the records already taken */
+    saved = pos;
+    workload_reset();
+    while (pos.records < saved.records && nextrecord(&a))
+      ;
+    pos = saved;
+  }
+}
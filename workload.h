@@ -0,0 +1,41 @@
+/* ******************************************************************
+   Message arrival processes.  The emulator asks for the time until the
+   next message from layer 5; how that gap is drawn is chosen at run
+   time:
+
+     uniform   uniform on [0, 2*lambda], the original process
+     poisson   exponential with mean lambda
+     onoff     bursts of messages at ONOFF_PEAK times the mean rate,
+               separated by silences; burst sizes and silences are
+               Pareto distributed, so both are heavy tailed, and the
+               mean rate is still one message per lambda
+     saturate  a new message whenever A's window has room (the
+               emulator does this one, it needs the protocol)
+     trace     arrival times and sizes replayed from a file
+
+   A trace file holds one arrival per line: the time in time units since
+   the start of the run, never decreasing, and the size in bytes.  Sizes
+   are rounded up to whole 20 byte messages, all offered at that time.
+   The file is read TRACE_CHUNK records at a time, so traces of any
+   length can be replayed.
+**********************************************************************/
+
+#define ARRIVE_UNIFORM  0
+#define ARRIVE_POISSON  1
+#define ARRIVE_ONOFF    2
+#define ARRIVE_SATURATE 3
+#define ARRIVE_TRACE    4
+
+#define WORKLOAD_NONE (-1.0)   /* gap when the trace has no more arrivals */
+
+extern int workload_kind;
+
+extern int workload_byname(const char *name);
+extern void workload_open(const char *name);
+extern void workload_close(void);
+extern void workload_reset(void);
+extern double workload_gap(double now, double lambda);
+extern void workload_report(void);
+
+struct ckpt;
+extern void workload_checkpoint(struct ckpt *c);